@@ -0,0 +1,42 @@
+// Stack versus register backend. Compiles each opcode category for both backends
+// and reports the instructions executed per evaluation and the time per evaluation.
+// JIT builds add the time of the native backend for the categories it compiles.
+#include "categories.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char *argv[]) {
+  const double seconds = (argc > 1) ? std::atof(argv[1]) : 0.2;
+
+  pips::VM vm;
+  printf("%-12s %12s %12s %12s %12s %8s %12s\n", "category", "stack instr", "reg instr",
+         "stack ns", "reg ns", "speedup", "native ns");
+  for (auto &category : bench::categories()) {
+    auto stack = vm.compile(category.source.c_str(), category.end_line, {"x", "y"},
+                            pips::Backend::STACK);
+    auto registers = vm.compile(category.source.c_str(), category.end_line, {"x", "y"},
+                                pips::Backend::REGISTER);
+    auto native = vm.compile(category.source.c_str(), category.end_line, {"x", "y"},
+                             pips::Backend::NATIVE);
+    if (!stack || !registers || !native) return 1;
+    const double stackInstructions = (category.stackInstructions > 0)
+                                         ? category.stackInstructions
+                                         : bench::countInstructions(stack->chunk);
+    const double registerInstructions =
+        (category.registerInstructions > 0)
+            ? category.registerInstructions
+            : static_cast<double>(registers->registerCode.code.size());
+    long evals = 0;
+    const double stackTime = bench::timeProgram(vm, *stack, seconds, evals);
+    const double registerTime = bench::timeProgram(vm, *registers, seconds, evals);
+    printf("%-12s %12.0f %12.0f %12.1f %12.1f %8.2f", category.name, stackInstructions,
+           registerInstructions, stackTime, registerTime, stackTime / registerTime);
+    if (native->native != nullptr) {
+      printf(" %12.1f\n", bench::timeProgram(vm, *native, seconds, evals));
+    } else {
+      printf(" %12s\n", "-");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+// Workloads shared by the interpreter microbenchmarks: one small program per opcode
+// category, and a timer that reports the best time per evaluation.
+#ifndef PIPS_BENCH_CATEGORIES_HPP_
+#define PIPS_BENCH_CATEGORIES_HPP_
+
+#include <pips/vm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+struct Category {
+  const char *name;
+  std::string source;
+  char end_line;
+  // Instructions executed per evaluation; 0 counts straight-line code statically.
+  double stackInstructions;
+  double registerInstructions;
+};
+
+inline std::string repeat(int count, const std::string &first, const std::string &step) {
+  std::string source = first;
+  for (int i = 0; i < count; i++) source += step;
+  return source;
+}
+
+inline std::vector<Category> categories() {
+  const int N = 32;
+  return {
+      {"arithmetic", repeat(N, "x", " + y * x - y / x"), '\n', 0, 0},
+      {"comparison", repeat(N, "x < y", " == !(y < x)"), '\n', 0, 0},
+      {"math", repeat(N, "sin(x)", " + sqrt(y) * floor(x)"), '\n', 0, 0},
+      {"constants", repeat(N, "1", " + 2 * 3"), '\n', 0, 0},
+      // Blocks leave their result in a global, so that every backend computes it.
+      {"locals",
+       "var r = 0; { var a = x; var b = y;" + repeat(N, "", " a = a + b; b = a * b;") +
+           " r = b; }",
+       ';', 0, 0},
+      {"globals", "var g = x; var h = y;" + repeat(N, "", " g = g + h; h = g * h;"), ';', 0, 0},
+      // Per iteration: 11 stack instructions, or LESS, JUMP_IF_FALSE, ADD and JUMP.
+      {"loop", "var n = 0; { var i = 0; while (i < 100) i = i + 1; n = i; }", ';',
+       11 * 100 + 13, 4 * 100 + 6},
+  };
+}
+
+// Number of instructions in straight-line stack code.
+inline double countInstructions(const pips::Chunk<double> &chunk) {
+  double count = 0;
+  for (size_t i = 0; i < chunk.code.size(); i += pips::instructionLength(chunk.code[i])) {
+    count++;
+  }
+  return count;
+}
+
+// Best time in nanoseconds of one run of `program`, over five timed runs of
+// `seconds / 5` each. `evals` receives the total number of runs.
+inline double timeProgram(pips::VM<double> &vm, const pips::Program<double> &program,
+                          double seconds, long &evals) {
+  double frame[2] = {1.25, 0.75};
+  double best = 1e30;
+  evals = 0;
+  for (int run = 0; run < 5; run++) {
+    const auto start = std::chrono::steady_clock::now();
+    long count = 0;
+    double elapsed = 0;
+    do {
+      for (int k = 0; k < 64; k++) vm.run(program, static_cast<const double *>(frame));
+      count += 64;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < seconds / 5);
+    best = std::min(best, elapsed * 1e9 / count);
+    evals += count;
+  }
+  return best;
+}
+
+} // namespace bench
+#endif // PIPS_BENCH_CATEGORIES_HPP_
@@ -0,0 +1,29 @@
+// Interpreter dispatch microbenchmark. Runs a compiled program per opcode
+// category many times and reports the time per evaluation and per executed
+// instruction. Built twice: dispatch_bench uses the default dispatch (computed
+// goto on GCC and Clang) and dispatch_bench_switch forces the switch loop, so
+// comparing their output gives the before and after numbers.
+#include "categories.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char *argv[]) {
+  const double seconds = (argc > 1) ? std::atof(argv[1]) : 0.2;
+
+  pips::VM vm;
+  printf("dispatch: %s\n", PIPS_COMPUTED_GOTO ? "computed goto" : "switch");
+  printf("%-12s %12s %12s %10s\n", "category", "evals", "ns/eval", "ns/instr");
+  for (auto &category : bench::categories()) {
+    auto program = vm.compile(category.source.c_str(), category.end_line, {"x", "y"},
+                              pips::Backend::STACK);
+    if (!program) return 1;
+    const double instructions = (category.stackInstructions > 0)
+                                    ? category.stackInstructions
+                                    : bench::countInstructions(program->chunk);
+    long evals = 0;
+    const double best = bench::timeProgram(vm, *program, seconds, evals);
+    printf("%-12s %12ld %12.1f %10.2f\n", category.name, evals, best, best / instructions);
+  }
+  return 0;
+}
@@ -0,0 +1,133 @@
+#ifndef PIPS_ARENA_HPP_
+#define PIPS_ARENA_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace pips {
+
+struct ArenaStats {
+  // Allocations served by the arena and the blocks it obtained from the heap for
+  // them, since it was created.
+  size_t allocations = 0;
+  size_t blocks = 0;
+  // Bytes handed out since the last reset, and the total size of the blocks.
+  size_t used = 0;
+  size_t capacity = 0;
+  size_t resets = 0;
+};
+
+// Bump allocator for data that only lives while a script is compiled: the
+// compiler's bookkeeping and the passes run over the code. Memory is taken from
+// large blocks and never freed on its own. reset() makes all of it available again
+// and keeps the blocks, merged into one, so that once the arena has grown to the
+// largest compilation, compiling again does not touch the heap.
+//
+// Containers use an arena through ArenaAllocator, which takes the arena made active
+// on the current thread by an ArenaScope, or the heap outside of any scope.
+struct Arena {
+  static constexpr size_t BLOCK_SIZE = 16 * 1024;
+
+  struct Block {
+    std::unique_ptr<char[]> memory;
+    size_t size;
+  };
+  std::vector<Block> blocks;
+  size_t block = 0; // block being allocated from
+  size_t offset = 0;
+  ArenaStats stats;
+
+  Arena() = default;
+  ~Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *allocate(size_t size, size_t align) {
+    for (;; block++, offset = 0) {
+      if (block == blocks.size()) addBlock(std::max(BLOCK_SIZE, size + align));
+      char *base = blocks[block].memory.get();
+      const uintptr_t at = reinterpret_cast<uintptr_t>(base + offset);
+      const size_t start = offset + ((align - at % align) % align);
+      if (start + size > blocks[block].size) continue;
+      offset = start + size;
+      stats.allocations++;
+      stats.used += size;
+      return base + start;
+    }
+  }
+  void reset() {
+    if (blocks.size() > 1) {
+      const size_t total = stats.capacity;
+      blocks.clear();
+      stats.capacity = 0;
+      addBlock(total);
+    }
+    block = 0;
+    offset = 0;
+    stats.used = 0;
+    stats.resets++;
+  }
+  void addBlock(size_t size) {
+    blocks.push_back({std::make_unique<char[]>(size), size});
+    stats.blocks++;
+    stats.capacity += size;
+  }
+
+  // Arena used by the ArenaAllocators constructed on this thread, if any.
+  static Arena *&active() {
+    thread_local Arena *arena = nullptr;
+    return arena;
+  }
+};
+
+// Makes `arena` active on this thread for the lifetime of the scope.
+struct ArenaScope {
+  Arena *previous;
+
+  explicit ArenaScope(Arena &arena) : previous(Arena::active()) { Arena::active() = &arena; }
+  ~ArenaScope() { Arena::active() = previous; }
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+};
+
+// Allocator for the arena active when it is constructed, or for the heap. Containers
+// copied or moved from one another share the allocator of the source.
+template <typename T>
+struct ArenaAllocator {
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  Arena *arena;
+
+  ArenaAllocator() : arena(Arena::active()) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(size_t n) {
+    if (arena == nullptr) return std::allocator<T>().allocate(n);
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *p, size_t n) {
+    if (arena == nullptr) std::allocator<T>().deallocate(p, n);
+  }
+  template <typename U>
+  bool operator==(const ArenaAllocator<U> &other) const {
+    return arena == other.arena;
+  }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U> &other) const {
+    return arena != other.arena;
+  }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+} // namespace pips
+#endif // PIPS_ARENA_HPP_
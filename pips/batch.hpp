@@ -0,0 +1,397 @@
+#ifndef PIPS_BATCH_HPP_
+#define PIPS_BATCH_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <type_traits>
+#include <vector>
+
+#include "chunk.hpp"
+#include "math.hpp"
+#include "program.hpp"
+#include "simd.hpp"
+#include "types.hpp"
+#include "value.hpp"
+#include "vm.hpp"
+
+namespace pips {
+
+// Evaluates one compiled program over columns of inputs. Straight-line numeric
+// programs (constants, inputs, numeric globals, arithmetic, comparisons and the
+// math builtins) run block by block: each instruction is dispatched once per block
+// of BLOCK_SIZE elements and applied to contiguous lane arrays. Any other program
+// falls back to one Context::run per element. The result of an element is the
+// value of the script's final expression statement. For doubles the math builtins
+// use the vector kernels of simd.hpp.
+template <typename Real = DefaultReal>
+struct BatchEvaluator {
+  using Value = pips::Value<Real>;
+  using Program = pips::Program<Real>;
+  using Context = pips::Context<Real>;
+
+  static constexpr size_t BLOCK_SIZE = 256;
+
+  // Static type of a stack slot while decoding. Booleans are stored as 0 or 1.
+  enum class LaneType : uint8_t { NUMBER, BOOL };
+
+  // A decoded instruction with the stack depth it starts at.
+  struct BlockOp {
+    uint8_t op;
+    uint16_t operand;
+    int depth;
+    Real constant;
+  };
+
+  Context *context;
+  std::vector<BlockOp> ops;
+  std::vector<Real> lanes;          // BLOCK_SIZE values per stack slot
+  std::vector<const Real *> slots;  // current contents of each stack slot
+  std::vector<Real> frame;          // input frame for the scalar fallback
+  int maxDepth;
+  // Math kernels for double lanes. Set to simd::kernels(simd::Isa::SCALAR) for
+  // results bit-identical to VM::run.
+  const simd::Kernels *kernels;
+
+  // Runs on `context_`; give each thread its own context and evaluator.
+  explicit BatchEvaluator(Context &context_)
+      : context(&context_), maxDepth(0), kernels(&simd::kernels()) {}
+  ~BatchEvaluator() = default;
+
+  // Evaluate `program` for n elements. columns[i] holds the n values of the
+  // program's input i; out[k] receives the result of element k (booleans as 0/1).
+  // Errors name element `base + k`, for callers evaluating a range of larger columns.
+  InterpretResult evaluate(const Program &program, const Real *const *columns, Real *out,
+                           size_t n, size_t base = 0) {
+    if (!decode(program)) {
+      return evaluateScalar(program, columns, out, n, base);
+    }
+    for (size_t start = 0; start < n; start += BLOCK_SIZE) {
+      runBlock(columns, out, start, std::min(BLOCK_SIZE, n - start));
+    }
+    return InterpretResult::OK;
+  }
+
+  // Decode the program into block ops. Returns false if it cannot run in blocks.
+  bool decode(const Program &program) {
+    const auto &chunk = program.chunk;
+    const auto &code = chunk.code;
+    std::vector<LaneType> types;
+    ops.clear();
+    maxDepth = 0;
+
+    auto push = [&](LaneType type) {
+      types.push_back(type);
+      maxDepth = std::max(maxDepth, static_cast<int>(types.size()));
+    };
+    auto numbers = [&](int count) {
+      if (static_cast<int>(types.size()) < count) return false;
+      for (int k = 1; k <= count; k++) {
+        if (types[types.size() - k] != LaneType::NUMBER) return false;
+      }
+      return true;
+    };
+
+    size_t i = 0;
+    while (i < code.size()) {
+      // Lanes are numbers already, so unchecked opcodes run like the checked ones.
+      BlockOp bop{checkedOp(narrowOp(code[i])), 0, static_cast<int>(types.size()), Real(0)};
+      switch (bop.op) {
+      case OpCode::CONSTANT: {
+        const Value &constant = chunk.constants[operandAt(code, i)];
+        if (!IS_NUMBER(constant)) return false;
+        bop.constant = AS_NUMBER(constant);
+        push(LaneType::NUMBER);
+        i += instructionLength(code[i]);
+        break;
+      }
+      case OpCode::TRUE:
+      case OpCode::FALSE:
+        bop.constant = (code[i] == OpCode::TRUE) ? Real(1) : Real(0);
+        bop.op = OpCode::CONSTANT;
+        push(LaneType::BOOL);
+        i += 1;
+        break;
+      case OpCode::GET_INPUT:
+        bop.operand = code[i + 1];
+        push(LaneType::NUMBER);
+        i += 2;
+        break;
+      case OpCode::GET_GLOBAL: {
+        // Globals cannot change while a straight-line numeric program runs.
+        const int slot = (code[i + 1] << 8) | code[i + 2];
+        const Value *global = context->getGlobal(slot);
+        if (global == nullptr || !IS_NUMBER(*global)) return false;
+        bop.op = OpCode::CONSTANT;
+        bop.constant = AS_NUMBER(*global);
+        push(LaneType::NUMBER);
+        i += 3;
+        break;
+      }
+      case OpCode::NEGATE:
+      case OpCode::UPLUS:
+      case OpCode::EXP:
+      case OpCode::SIN:
+      case OpCode::COS:
+      case OpCode::TAN:
+      case OpCode::ABS:
+      case OpCode::LOG:
+      case OpCode::LOG10:
+      case OpCode::SIGN:
+      case OpCode::SQRT:
+      case OpCode::ACOS:
+      case OpCode::ASIN:
+      case OpCode::ATAN:
+      case OpCode::CEIL:
+      case OpCode::FLOOR:
+        if (!numbers(1)) return false;
+        i += 1;
+        break;
+      case OpCode::ADD:
+      case OpCode::SUBTRACT:
+      case OpCode::MULTIPLY:
+      case OpCode::DIVIDE:
+      case OpCode::INTDIVIDE:
+      case OpCode::MOD:
+      case OpCode::POW:
+      case OpCode::ATAN2:
+      case OpCode::MIN:
+      case OpCode::MAX:
+        if (!numbers(2)) return false;
+        types.pop_back();
+        i += 1;
+        break;
+      case OpCode::GREATER:
+      case OpCode::LESS:
+      case OpCode::GREATER_EQUAL:
+      case OpCode::LESS_EQUAL:
+        if (!numbers(2)) return false;
+        types.pop_back();
+        types.back() = LaneType::BOOL;
+        i += 1;
+        break;
+      case OpCode::EQUAL:
+      case OpCode::NOT_EQUAL:
+        // Values of different types are never equal, so only same-typed lanes qualify.
+        if (types.size() < 2 || types[types.size() - 1] != types[types.size() - 2]) {
+          return false;
+        }
+        types.pop_back();
+        types.back() = LaneType::BOOL;
+        i += 1;
+        break;
+      case OpCode::NOT:
+        if (types.empty()) return false;
+        types.back() = LaneType::BOOL;
+        i += 1;
+        break;
+      case OpCode::POP:
+        if (types.empty()) return false;
+        types.pop_back();
+        i += 1;
+        break;
+      case OpCode::RETURN:
+        // The result must be the only value left on the stack.
+        if (types.size() != 1) return false;
+        ops.push_back(bop);
+        lanes.resize(static_cast<size_t>(maxDepth) * BLOCK_SIZE);
+        slots.resize(maxDepth);
+        return true;
+      default:
+        return false;
+      }
+      ops.push_back(bop);
+    }
+    return false;
+  }
+
+  Real *lane(int depth) { return &lanes[static_cast<size_t>(depth) * BLOCK_SIZE]; }
+
+  template <typename F>
+  void unary(int depth, size_t len, F f) {
+    const Real *a = slots[depth];
+    Real *r = lane(depth);
+    for (size_t i = 0; i < len; i++) {
+      r[i] = f(a[i]);
+    }
+    slots[depth] = r;
+  }
+  template <typename F>
+  void binary(int depth, size_t len, F f) {
+    const Real *a = slots[depth];
+    const Real *b = slots[depth + 1];
+    Real *r = lane(depth);
+    for (size_t i = 0; i < len; i++) {
+      r[i] = f(a[i], b[i]);
+    }
+    slots[depth] = r;
+  }
+  // Use the array kernel when lanes are doubles, and `f` otherwise.
+  template <typename F>
+  void unary(int depth, size_t len, simd::UnaryKernel kernel, F f) {
+    if constexpr (std::is_same_v<Real, double>) {
+      kernel(slots[depth], lane(depth), len);
+      slots[depth] = lane(depth);
+    } else {
+      unary(depth, len, f);
+    }
+  }
+  template <typename F>
+  void binary(int depth, size_t len, simd::BinaryKernel kernel, F f) {
+    if constexpr (std::is_same_v<Real, double>) {
+      kernel(slots[depth], slots[depth + 1], lane(depth), len);
+      slots[depth] = lane(depth);
+    } else {
+      binary(depth, len, f);
+    }
+  }
+
+  void runBlock(const Real *const *columns, Real *out, size_t start, size_t len) {
+    for (const auto &bop : ops) {
+      const int top = bop.depth - 1;
+      const int lhs = bop.depth - 2;
+      switch (bop.op) {
+      case OpCode::CONSTANT: {
+        Real *r = lane(bop.depth);
+        std::fill(r, r + len, bop.constant);
+        slots[bop.depth] = r;
+        break;
+      }
+      case OpCode::GET_INPUT:
+        slots[bop.depth] = columns[bop.operand] + start;
+        break;
+      case OpCode::NEGATE:
+        unary(top, len, [](Real a) { return -a; });
+        break;
+      case OpCode::UPLUS:
+        break;
+      case OpCode::EXP:
+        unary(top, len, kernels->exp, [](Real a) { return std::exp(a); });
+        break;
+      case OpCode::SIN:
+        unary(top, len, kernels->sin, [](Real a) { return pips::sin(a); });
+        break;
+      case OpCode::COS:
+        unary(top, len, kernels->cos, [](Real a) { return pips::cos(a); });
+        break;
+      case OpCode::TAN:
+        unary(top, len, kernels->tan, [](Real a) { return pips::tan(a); });
+        break;
+      case OpCode::ABS:
+        unary(top, len, [](Real a) { return std::abs(a); });
+        break;
+      case OpCode::LOG:
+        unary(top, len, kernels->log, [](Real a) { return std::log(a); });
+        break;
+      case OpCode::LOG10:
+        unary(top, len, [](Real a) { return std::log10(a); });
+        break;
+      case OpCode::SIGN:
+        unary(top, len, [](Real a) { return a < Real(0) ? Real(-1) : Real(1); });
+        break;
+      case OpCode::SQRT:
+        unary(top, len, kernels->sqrt, [](Real a) { return std::sqrt(a); });
+        break;
+      case OpCode::ACOS:
+        unary(top, len, [](Real a) { return std::acos(a); });
+        break;
+      case OpCode::ASIN:
+        unary(top, len, [](Real a) { return std::asin(a); });
+        break;
+      case OpCode::ATAN:
+        unary(top, len, [](Real a) { return std::atan(a); });
+        break;
+      case OpCode::CEIL:
+        unary(top, len, kernels->ceil, [](Real a) { return std::ceil(a); });
+        break;
+      case OpCode::FLOOR:
+        unary(top, len, kernels->floor, [](Real a) { return std::floor(a); });
+        break;
+      case OpCode::NOT:
+        unary(top, len, [](Real a) { return a == Real(0) ? Real(1) : Real(0); });
+        break;
+      case OpCode::ADD:
+        binary(lhs, len, [](Real a, Real b) { return a + b; });
+        break;
+      case OpCode::SUBTRACT:
+        binary(lhs, len, [](Real a, Real b) { return a - b; });
+        break;
+      case OpCode::MULTIPLY:
+        binary(lhs, len, [](Real a, Real b) { return a * b; });
+        break;
+      case OpCode::DIVIDE:
+        binary(lhs, len, [](Real a, Real b) { return a / b; });
+        break;
+      case OpCode::INTDIVIDE:
+        binary(lhs, len, [](Real a, Real b) { return static_cast<Real>(static_cast<int>(a / b)); });
+        break;
+      case OpCode::MOD:
+        binary(lhs, len, [](Real a, Real b) {
+          return static_cast<Real>(static_cast<int>(a) % static_cast<int>(b));
+        });
+        break;
+      case OpCode::POW:
+        binary(lhs, len, kernels->pow, [](Real a, Real b) { return std::pow(a, b); });
+        break;
+      case OpCode::ATAN2:
+        binary(lhs, len, kernels->atan2, [](Real a, Real b) { return std::atan2(a, b); });
+        break;
+      case OpCode::MIN:
+        binary(lhs, len, kernels->min, [](Real a, Real b) { return std::min(a, b); });
+        break;
+      case OpCode::MAX:
+        binary(lhs, len, kernels->max, [](Real a, Real b) { return std::max(a, b); });
+        break;
+      case OpCode::GREATER:
+        binary(lhs, len, [](Real a, Real b) { return a > b ? Real(1) : Real(0); });
+        break;
+      case OpCode::LESS:
+        binary(lhs, len, [](Real a, Real b) { return a < b ? Real(1) : Real(0); });
+        break;
+      case OpCode::EQUAL:
+        binary(lhs, len, [](Real a, Real b) { return a == b ? Real(1) : Real(0); });
+        break;
+      case OpCode::NOT_EQUAL:
+        binary(lhs, len, [](Real a, Real b) { return a == b ? Real(0) : Real(1); });
+        break;
+      case OpCode::GREATER_EQUAL:
+        binary(lhs, len, [](Real a, Real b) { return a < b ? Real(0) : Real(1); });
+        break;
+      case OpCode::LESS_EQUAL:
+        binary(lhs, len, [](Real a, Real b) { return a > b ? Real(0) : Real(1); });
+        break;
+      case OpCode::POP:
+        break;
+      case OpCode::RETURN:
+        std::copy(slots[0], slots[0] + len, out + start);
+        break;
+      }
+    }
+  }
+
+  InterpretResult evaluateScalar(const Program &program, const Real *const *columns, Real *out,
+                                 size_t n, size_t base) {
+    const size_t count = program.inputs.size();
+    frame.resize(count);
+    for (size_t k = 0; k < n; k++) {
+      for (size_t i = 0; i < count; i++) {
+        frame[i] = columns[i][k];
+      }
+      auto status = context->run(program, static_cast<const Real *>(frame.data()));
+      if (status != InterpretResult::OK) return status;
+      const Value &result = context->returnValue;
+      if (IS_NUMBER(result)) {
+        out[k] = AS_NUMBER(result);
+      } else if (IS_BOOL(result)) {
+        out[k] = AS_BOOL(result) ? Real(1) : Real(0);
+      } else {
+        std::fprintf(stderr, "Result of element %zu is not a number.\n", base + k);
+        return InterpretResult::RUNTIME_ERROR;
+      }
+    }
+    return InterpretResult::OK;
+  }
+};
+
+} // namespace pips
+#endif // PIPS_BATCH_HPP_
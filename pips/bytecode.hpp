@@ -0,0 +1,434 @@
+#ifndef PIPS_BYTECODE_HPP_
+#define PIPS_BYTECODE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chunk.hpp"
+#include "globals.hpp"
+#include "program.hpp"
+#include "value.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PIPS_BYTECODE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define PIPS_BYTECODE_MMAP 0
+#endif
+
+namespace pips {
+
+// On-disk format of compiled programs, written by VM::save and read by VM::load. A
+// file is a fixed header followed by the payload, in the byte order of the machine
+// that wrote it:
+//
+//   header   magic "PIPSBC\r\n", format version, opcode table fingerprint,
+//            sizeof(Real), byte order mark, payload size and CRC-32 of the payload
+//   payload  end_line, code, line table (as runs, see LineTable), constants,
+//            inputs, globals
+//
+// Global slots are private to the VM that compiled a program, so the payload lists
+// the name of every slot the code uses and the loader rewrites the operands to the
+// slots of the loading VM. Files from another format version, opcode set, numeric
+// type or byte order are rejected rather than converted.
+namespace bytecode {
+
+constexpr char MAGIC[8] = {'P', 'I', 'P', 'S', 'B', 'C', '\r', '\n'};
+constexpr uint32_t VERSION = 2;
+constexpr uint32_t ORDER_MARK = 0x01020304;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t opcodes;
+  uint32_t realSize;
+  uint32_t byteOrder;
+  uint64_t payloadSize;
+  uint32_t checksum;
+  uint32_t reserved;
+};
+static_assert(sizeof(Header) == 40, "bytecode header must not be padded");
+
+// CRC-32 (IEEE), eight bytes per step.
+inline uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+  static const auto tables = [] {
+    std::array<std::array<uint32_t, 256>, 8> entries{};
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      entries[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+      for (int t = 1; t < 8; t++) {
+        entries[t][n] = (entries[t - 1][n] >> 8) ^ entries[0][entries[t - 1][n] & 0xff];
+      }
+    }
+    return entries;
+  }();
+  crc = ~crc;
+  for (; size >= 8; data += 8, size -= 8) {
+    const uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 |
+                                static_cast<uint32_t>(data[3]) << 24);
+    crc = tables[7][low & 0xff] ^ tables[6][(low >> 8) & 0xff] ^
+          tables[5][(low >> 16) & 0xff] ^ tables[4][low >> 24] ^ tables[3][data[4]] ^
+          tables[2][data[5]] ^ tables[1][data[6]] ^ tables[0][data[7]];
+  }
+  for (; size > 0; data++, size--) crc = tables[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+// Fingerprint of the opcode names and their order: files store opcodes by number.
+inline uint32_t opcodeFingerprint() {
+  static const uint32_t fingerprint = [] {
+    uint32_t crc = 0;
+    for (int op = 0; op < OPCODE_COUNT; op++) {
+      const char *name = opcodeName(static_cast<uint8_t>(op));
+      crc = crc32(reinterpret_cast<const uint8_t *>(name), std::strlen(name) + 1, crc);
+    }
+    return crc;
+  }();
+  return fingerprint;
+}
+
+enum class Tag : uint8_t { NIL, BOOL, NUMBER, STRING };
+
+struct Writer {
+  std::vector<uint8_t> bytes;
+
+  template <typename T>
+  void put(const T &value) {
+    const auto *raw = reinterpret_cast<const uint8_t *>(&value);
+    bytes.insert(bytes.end(), raw, raw + sizeof(T));
+  }
+  void put(const void *data, size_t size) {
+    const auto *raw = static_cast<const uint8_t *>(data);
+    bytes.insert(bytes.end(), raw, raw + size);
+  }
+  void putString(std::string_view text) {
+    put(static_cast<uint32_t>(text.size()));
+    put(text.data(), text.size());
+  }
+};
+
+// Reads the payload; any read past the end clears `ok` and returns zeros.
+struct Reader {
+  const uint8_t *at;
+  const uint8_t *end;
+  bool ok = true;
+
+  bool has(size_t size) {
+    if (static_cast<size_t>(end - at) < size) ok = false;
+    return ok;
+  }
+  template <typename T>
+  T get() {
+    T value{};
+    if (!has(sizeof(T))) return value;
+    std::memcpy(&value, at, sizeof(T));
+    at += sizeof(T);
+    return value;
+  }
+  const uint8_t *take(size_t size) {
+    if (!has(size)) return nullptr;
+    const uint8_t *start = at;
+    at += size;
+    return start;
+  }
+  std::string_view getString() {
+    const uint32_t size = get<uint32_t>();
+    const uint8_t *chars = take(size);
+    return chars ? std::string_view(reinterpret_cast<const char *>(chars), size)
+                 : std::string_view();
+  }
+};
+
+template <typename Real>
+std::vector<uint8_t> serialize(const Program<Real> &program, const GlobalTable &globals) {
+  const auto &chunk = program.chunk;
+  Writer payload;
+  payload.put(static_cast<uint8_t>(program.end_line));
+  payload.put(static_cast<uint32_t>(chunk.code.size()));
+  payload.put(chunk.code.data(), chunk.code.size());
+  payload.put(static_cast<uint32_t>(chunk.lines.runs.size()));
+  for (const auto &run : chunk.lines.runs) {
+    payload.put(run.start);
+    payload.put(run.line);
+  }
+
+  payload.put(static_cast<uint32_t>(chunk.constants.size()));
+  for (const auto &constant : chunk.constants) {
+    if (IS_NUMBER(constant)) {
+      payload.put(Tag::NUMBER);
+      payload.put(AS_NUMBER(constant));
+    } else if (IS_BOOL(constant)) {
+      payload.put(Tag::BOOL);
+      payload.put(static_cast<uint8_t>(AS_BOOL(constant)));
+    } else if (IS_STRING(constant)) {
+      payload.put(Tag::STRING);
+      payload.putString(stringView(AS_STRING(constant)));
+    } else {
+      payload.put(Tag::NIL);
+    }
+  }
+
+  payload.put(static_cast<uint32_t>(program.inputs.size()));
+  for (const auto &input : program.inputs) payload.putString(input);
+
+  // Names of the global slots the code uses, by slot.
+  std::vector<uint16_t> slots;
+  for (size_t i = 0; i < chunk.code.size(); i += instructionLength(chunk.code[i])) {
+    const uint8_t op = chunk.code[i];
+    if (op == OpCode::DEFINE_GLOBAL || op == OpCode::GET_GLOBAL || op == OpCode::SET_GLOBAL) {
+      const auto slot = static_cast<uint16_t>((chunk.code[i + 1] << 8) | chunk.code[i + 2]);
+      if (std::find(slots.begin(), slots.end(), slot) == slots.end()) slots.push_back(slot);
+    }
+  }
+  payload.put(static_cast<uint32_t>(slots.size()));
+  for (uint16_t slot : slots) {
+    payload.put(slot);
+    payload.putString(globals.name(slot));
+  }
+
+  Header header{};
+  std::memcpy(header.magic, MAGIC, sizeof MAGIC);
+  header.version = VERSION;
+  header.opcodes = opcodeFingerprint();
+  header.realSize = sizeof(Real);
+  header.byteOrder = ORDER_MARK;
+  header.payloadSize = payload.bytes.size();
+  header.checksum = crc32(payload.bytes.data(), payload.bytes.size());
+  Writer file;
+  file.put(header);
+  file.put(payload.bytes.data(), payload.bytes.size());
+  return std::move(file.bytes);
+}
+
+inline bool isBytecode(const uint8_t *data, size_t size) {
+  return size >= sizeof MAGIC && std::memcmp(data, MAGIC, sizeof MAGIC) == 0;
+}
+inline bool isBytecodeFile(const std::string &path) {
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) return false;
+  uint8_t magic[sizeof MAGIC];
+  const size_t size = std::fread(magic, 1, sizeof magic, file);
+  std::fclose(file);
+  return isBytecode(magic, size);
+}
+
+// Rebuild a program from a file image. Names of globals are resolved in `globals`.
+// Returns an error message, or an empty string on success.
+template <typename Real>
+std::string deserialize(const uint8_t *data, size_t size, GlobalTable &globals,
+                        Program<Real> &program) {
+  using Value = pips::Value<Real>;
+  Header header;
+  if (size < sizeof header || !isBytecode(data, size)) return "not a pips bytecode file";
+  std::memcpy(&header, data, sizeof header);
+  if (header.byteOrder != ORDER_MARK) return "written on a machine of another byte order";
+  if (header.version != VERSION) return "unsupported format version";
+  if (header.opcodes != opcodeFingerprint()) return "compiled for another opcode set";
+  if (header.realSize != sizeof(Real)) return "compiled for another numeric type";
+  if (header.payloadSize != size - sizeof header) return "truncated";
+  const uint8_t *payload = data + sizeof header;
+  if (crc32(payload, header.payloadSize) != header.checksum) return "checksum mismatch";
+
+  Reader in{payload, payload + header.payloadSize};
+  auto &chunk = program.chunk;
+  program.end_line = static_cast<char>(in.get<uint8_t>());
+  const uint32_t codeSize = in.get<uint32_t>();
+  if (const uint8_t *code = in.take(codeSize)) chunk.code.assign(code, code + codeSize);
+  // Runs start in order, the first at the start of the code.
+  const uint32_t runCount = in.get<uint32_t>();
+  if (runCount > codeSize) return "malformed line table";
+  chunk.lines.clear();
+  for (uint32_t k = 0; k < runCount && in.ok; k++) {
+    const uint32_t start = in.get<uint32_t>();
+    const int32_t line = in.get<int32_t>();
+    const uint32_t previous = (k == 0) ? 0 : chunk.lines.runs.back().start + 1;
+    if (start < previous || start >= codeSize || (k == 0 && start != 0)) {
+      return "malformed line table";
+    }
+    chunk.lines.runs.push_back({start, line});
+  }
+  if (codeSize > 0 && runCount == 0) return "malformed line table";
+
+  const uint32_t constantCount = in.get<uint32_t>();
+  chunk.constants.clear();
+  for (uint32_t k = 0; k < constantCount && in.ok; k++) {
+    switch (in.get<Tag>()) {
+    case Tag::NIL:
+      chunk.constants.push_back(NIL_VAL);
+      break;
+    case Tag::BOOL:
+      chunk.constants.push_back(BOOL_VAL(in.get<uint8_t>() != 0));
+      break;
+    case Tag::NUMBER:
+      chunk.constants.push_back(NUMBER_VAL(in.get<Real>()));
+      break;
+    case Tag::STRING:
+      chunk.constants.push_back(STRING_VAL(in.getString()));
+      break;
+    default:
+      in.ok = false;
+    }
+  }
+
+  const uint32_t inputCount = in.get<uint32_t>();
+  program.inputs.clear();
+  for (uint32_t k = 0; k < inputCount && in.ok; k++) {
+    program.inputs.emplace_back(in.getString());
+  }
+
+  // Slots of the loading VM, indexed by the slots in the file.
+  std::vector<int> slots;
+  const uint32_t globalCount = in.get<uint32_t>();
+  for (uint32_t k = 0; k < globalCount && in.ok; k++) {
+    const uint16_t slot = in.get<uint16_t>();
+    if (slot >= slots.size()) slots.resize(slot + 1, -1);
+    slots[slot] = globals.resolve(in.getString());
+    if (slots[slot] < 0) return "too many globals";
+  }
+  if (!in.ok || in.at != in.end) return "malformed payload";
+
+  // Check every operand before anything runs, and move globals to this VM's slots.
+  auto &code = chunk.code;
+  // Instructions naming a local, with the largest slot each one uses.
+  std::vector<std::pair<size_t, uint32_t>> locals;
+  // Jumps must land on the first byte of an instruction, not inside an operand.
+  std::vector<uint8_t> isStart(code.size(), 0);
+  std::vector<size_t> jumps;
+  for (size_t i = 0; i < code.size(); i += instructionLength(code[i])) {
+    const uint8_t op = code[i];
+    if (op >= OPCODE_COUNT || i + instructionLength(op) > code.size()) return "malformed code";
+    isStart[i] = 1;
+    switch (narrowOp(op)) {
+    case OpCode::CONSTANT:
+      if (operandAt(code, i) >= chunk.constants.size()) return "malformed code";
+      break;
+    case OpCode::GET_LOCAL:
+    case OpCode::SET_LOCAL:
+      locals.push_back({i, operandAt(code, i)});
+      break;
+    case OpCode::MULTIPLY_LOCALS:
+      locals.push_back({i, std::max(code[i + 1], code[i + 2])});
+      break;
+    case OpCode::ADD_LOCAL_CONST:
+    case OpCode::SET_LOCAL_CONST:
+      if (code[i + 2] >= chunk.constants.size()) return "malformed code";
+      locals.push_back({i, code[i + 1]});
+      break;
+    case OpCode::GET_INPUT:
+      if (code[i + 1] >= program.inputs.size()) return "malformed code";
+      break;
+    case OpCode::JUMP:
+    case OpCode::JUMP_IF_FALSE:
+    case OpCode::LESS_JUMP_IF_FALSE:
+    case OpCode::LOOP: {
+      const size_t next = i + instructionLength(op);
+      const size_t offset = operandAt(code, i);
+      if (narrowOp(op) == OpCode::LOOP ? offset > next : next + offset >= code.size()) {
+        return "malformed code";
+      }
+      jumps.push_back(i);
+      break;
+    }
+    case OpCode::DEFINE_GLOBAL:
+    case OpCode::GET_GLOBAL:
+    case OpCode::SET_GLOBAL: {
+      const size_t saved = static_cast<size_t>((code[i + 1] << 8) | code[i + 2]);
+      const int slot = (saved < slots.size()) ? slots[saved] : -1;
+      if (slot < 0) return "malformed code";
+      code[i + 1] = static_cast<uint8_t>((slot >> 8) & 0xff);
+      code[i + 2] = static_cast<uint8_t>(slot & 0xff);
+      break;
+    }
+    }
+  }
+  for (size_t i : jumps) {
+    if (!isStart[jumpTarget(code, i)]) return "malformed code";
+  }
+  // Execution must not run off the end, and a local must already be on the stack
+  // wherever it is used.
+  ArenaVector<int> depthAt;
+  chunk.maxDepth = code.empty() ? -1 : chunk.computeMaxDepth(&depthAt);
+  if (chunk.maxDepth < 0) return "malformed code";
+  for (const auto &[i, slot] : locals) {
+    if (depthAt[i] >= 0 && slot >= static_cast<uint32_t>(depthAt[i])) return "malformed code";
+  }
+  return "";
+}
+
+inline bool writeFile(const std::string &path, const std::vector<uint8_t> &bytes) {
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) return false;
+  const bool written = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+  return (std::fclose(file) == 0) && written;
+}
+
+// A read-only image of a file: mapped where mmap is available, read otherwise.
+struct MappedFile {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  bool mapped = false;
+  std::vector<uint8_t> buffer;
+
+  MappedFile() = default;
+  ~MappedFile() {
+#if PIPS_BYTECODE_MMAP
+    if (mapped) munmap(const_cast<uint8_t *>(data), size);
+#endif
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const std::string &path) {
+#if PIPS_BYTECODE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      ::close(fd);
+      return false;
+    }
+    size = static_cast<size_t>(info.st_size);
+    if (size > 0) {
+#ifdef MAP_POPULATE
+      // The whole file is read right away: fault it in with one call.
+      const int flags = MAP_PRIVATE | MAP_POPULATE;
+#else
+      const int flags = MAP_PRIVATE;
+#endif
+      void *memory = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+      if (memory != MAP_FAILED) {
+        data = static_cast<const uint8_t *>(memory);
+        mapped = true;
+      }
+    }
+    ::close(fd);
+    if (mapped || size == 0) return true;
+#endif
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+    std::fseek(file, 0L, SEEK_END);
+    buffer.resize(static_cast<size_t>(std::ftell(file)));
+    std::rewind(file);
+    buffer.resize(std::fread(buffer.data(), 1, buffer.size(), file));
+    std::fclose(file);
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+  }
+};
+
+} // namespace bytecode
+} // namespace pips
+#endif // PIPS_BYTECODE_HPP_
@@ -0,0 +1,124 @@
+#ifndef PIPS_CACHE_HPP_
+#define PIPS_CACHE_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "program.hpp"
+
+namespace pips {
+
+struct CacheStats {
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t evictions = 0;
+  size_t size = 0;
+  size_t capacity = 0;
+};
+
+// Bounded least-recently-used map from the source text, end_line and the settings
+// it was compiled with (backend, optimizer) to a compiled program. A capacity of
+// zero disables the cache.
+template <typename Real = DefaultReal>
+struct ProgramCache {
+  struct Key {
+    std::string_view source;
+    char end_line;
+    Backend backend;
+    bool optimize;
+    bool operator==(const Key &other) const {
+      return end_line == other.end_line && backend == other.backend &&
+             optimize == other.optimize && source == other.source;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      const size_t settings = static_cast<size_t>(key.end_line) ^
+                              (static_cast<size_t>(key.backend) << 8) ^
+                              (static_cast<size_t>(key.optimize) << 10);
+      return std::hash<std::string_view>()(key.source) ^ settings;
+    }
+  };
+  struct Entry {
+    std::string source;
+    char end_line;
+    Backend backend;
+    bool optimize;
+    std::shared_ptr<const Program<Real>> program;
+  };
+
+  // Most recently used entries are at the front. The map keys view the source
+  // strings owned by the list nodes, which never move.
+  std::list<Entry> entries;
+  std::unordered_map<Key, typename std::list<Entry>::iterator, KeyHash> index;
+  CacheStats stats;
+
+  ProgramCache() = default;
+  ~ProgramCache() = default;
+  ProgramCache(const ProgramCache &) = delete;
+  ProgramCache &operator=(const ProgramCache &) = delete;
+
+  bool enabled() const { return stats.capacity > 0; }
+
+  void setCapacity(size_t capacity) {
+    stats.capacity = capacity;
+    evict();
+  }
+
+  std::shared_ptr<const Program<Real>> find(const char *source, char end_line,
+                                            Backend backend, bool optimize) {
+    auto found = index.find(Key{source, end_line, backend, optimize});
+    if (found == index.end()) {
+      stats.misses++;
+      return nullptr;
+    }
+    stats.hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->program;
+  }
+
+  void insert(const char *source, char end_line, Backend backend, bool optimize,
+              std::shared_ptr<const Program<Real>> program) {
+    if (!enabled()) return;
+    auto found = index.find(Key{source, end_line, backend, optimize});
+    if (found != index.end()) {
+      found->second->program = std::move(program);
+      entries.splice(entries.begin(), entries, found->second);
+      return;
+    }
+    entries.push_front(Entry{source, end_line, backend, optimize, std::move(program)});
+    index.emplace(Key{entries.front().source, end_line, backend, optimize}, entries.begin());
+    stats.size = entries.size();
+    evict();
+  }
+
+  void clear() {
+    index.clear();
+    entries.clear();
+    stats.size = 0;
+  }
+
+  void resetStats() {
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.evictions = 0;
+  }
+
+  void evict() {
+    while (entries.size() > stats.capacity) {
+      const auto &last = entries.back();
+      index.erase(Key{last.source, last.end_line, last.backend, last.optimize});
+      entries.pop_back();
+      stats.evictions++;
+    }
+    stats.size = entries.size();
+  }
+};
+
+} // namespace pips
+#endif // PIPS_CACHE_HPP_
@@ -8,130 +8,497 @@
 // https://github.com/munificent/craftinginterpreters under the MIT License.
 // The code was adapted for C++ and simplified in many ways.
 //===========================================================================
+#include "arena.hpp"
 #include "value.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <new>
 #include <vector>
 
 namespace pips {
+// Every opcode in encoding order. Expanded into the OpCode enum and into the
+// dispatch table of the interpreter loop.
+#define PIPS_OPCODES(X) \
+  X(CONSTANT) \
+  X(NIL) \
+  X(TRUE) \
+  X(FALSE) \
+  X(NEGATE) \
+  X(UPLUS) \
+  X(ADD) \
+  X(SUBTRACT) \
+  X(MULTIPLY) \
+  X(DIVIDE) \
+  X(INTDIVIDE) \
+  X(NOT) \
+  X(XOR) \
+  X(BOR) \
+  X(BAND) \
+  X(BNOT) \
+  X(LSHIFT) \
+  X(RSHIFT) \
+  X(EQUAL) \
+  X(GREATER) \
+  X(LESS) \
+  X(NOT_EQUAL) \
+  X(GREATER_EQUAL) \
+  X(LESS_EQUAL) \
+  X(EXP) \
+  X(SIN) \
+  X(COS) \
+  X(TAN) \
+  X(ABS) \
+  X(POW) \
+  X(MOD) \
+  X(LOG) \
+  X(LOG10) \
+  X(SIGN) \
+  X(SQRT) \
+  X(ACOS) \
+  X(ASIN) \
+  X(ATAN) \
+  X(CEIL) \
+  X(FLOOR) \
+  X(ATAN2) \
+  X(MIN) \
+  X(MAX) \
+  X(PRINT) \
+  X(LIST) \
+  X(NEWLINE) \
+  X(POP) \
+  X(DEFINE_GLOBAL) \
+  X(GET_GLOBAL) \
+  X(SET_GLOBAL) \
+  X(SET_LOCAL) \
+  X(GET_LOCAL) \
+  X(GET_INPUT) \
+  X(JUMP_IF_FALSE) \
+  X(JUMP) \
+  X(LOOP) \
+  X(CONSTANT_LONG) \
+  X(GET_LOCAL_LONG) \
+  X(SET_LOCAL_LONG) \
+  X(JUMP_IF_FALSE_LONG) \
+  X(JUMP_LONG) \
+  X(LOOP_LONG) \
+  X(ADD_LOCAL_CONST) \
+  X(MULTIPLY_LOCALS) \
+  X(SET_LOCAL_CONST) \
+  X(LESS_JUMP_IF_FALSE) \
+  X(ADD_NUM) \
+  X(SUBTRACT_NUM) \
+  X(MULTIPLY_NUM) \
+  X(DIVIDE_NUM) \
+  X(MOD_NUM) \
+  X(POW_NUM) \
+  X(NEGATE_NUM) \
+  X(RETURN)
+
 enum OpCode {
-  CONSTANT,
-  NIL,
-  TRUE,
-  FALSE,
-  NEGATE,
-  UPLUS,
-  ADD,
-  SUBTRACT,
-  MULTIPLY,
-  DIVIDE,
-  INTDIVIDE,
-  NOT,
-  XOR,
-  BOR,
-  BAND,
-  BNOT,
-  LSHIFT,
-  RSHIFT,
-  EQUAL,
-  GREATER,
-  LESS,
-  EXP,
-  SIN,
-  COS,
-  TAN,
-  ABS,
-  POW,
-  MOD,
-  LOG,
-  LOG10,
-  SIGN,
-  SQRT,
-  ACOS,
-  ASIN,
-  ATAN,
-  CEIL,
-  FLOOR,
-  ATAN2,
-  MIN,
-  MAX,
-  PRINT,
-  LIST,
-  NEWLINE,
-  POP,
-  DEFINE_GLOBAL,
-  GET_GLOBAL,
-  SET_GLOBAL,
-  SET_LOCAL,
-  GET_LOCAL,
-  JUMP_IF_FALSE,
-  JUMP,
-  LOOP,
-  RETURN
+#define PIPS_OPCODE_ENUM(name) name,
+  PIPS_OPCODES(PIPS_OPCODE_ENUM)
+#undef PIPS_OPCODE_ENUM
 };
+#define PIPS_OPCODE_ONE(name) +1
+inline constexpr int OPCODE_COUNT = 0 PIPS_OPCODES(PIPS_OPCODE_ONE);
+#undef PIPS_OPCODE_ONE
+
+inline const char *opcodeName(uint8_t op) {
+#define PIPS_OPCODE_NAME(name) #name,
+  static const char *const names[] = {PIPS_OPCODES(PIPS_OPCODE_NAME)};
+#undef PIPS_OPCODE_NAME
+  return (op < OPCODE_COUNT) ? names[op] : "UNKNOWN";
+}
 
 template <OpCode OP>
 inline constexpr bool is_ConstOp() {
-  return ((OP == OpCode::CONSTANT) || (OP == OpCode::DEFINE_GLOBAL) ||
-          (OP == OpCode::GET_GLOBAL) || (OP == OpCode::SET_GLOBAL));
+  return (OP == OpCode::CONSTANT);
 }
 template <OpCode OP>
 inline constexpr bool is_ByteOp() {
-  return ((OP == OpCode::SET_LOCAL) || (OP == OpCode::SET_LOCAL));
+  return ((OP == OpCode::GET_LOCAL) || (OP == OpCode::SET_LOCAL) ||
+          (OP == OpCode::GET_INPUT));
+}
+// Operand is a 16-bit global slot
+template <OpCode OP>
+inline constexpr bool is_GlobalOp() {
+  return ((OP == OpCode::DEFINE_GLOBAL) || (OP == OpCode::GET_GLOBAL) ||
+          (OP == OpCode::SET_GLOBAL));
+}
+// The *_NUM opcodes skip the operand type checks. The compiler emits them where it
+// knows the operands are numbers.
+#define PIPS_UNCHECKED_OPCODES(X) \
+  X(ADD) \
+  X(SUBTRACT) \
+  X(MULTIPLY) \
+  X(DIVIDE) \
+  X(MOD) \
+  X(POW) \
+  X(NEGATE)
+
+// Unchecked variant of op, or op itself if it has none.
+inline uint8_t uncheckedOp(uint8_t op) {
+  switch (op) {
+#define PIPS_UNCHECKED_CASE(name) \
+  case OpCode::name:              \
+    return OpCode::name##_NUM;
+    PIPS_UNCHECKED_OPCODES(PIPS_UNCHECKED_CASE)
+#undef PIPS_UNCHECKED_CASE
+  default:
+    return op;
+  }
 }
+// Checked opcode of an unchecked one, or op itself.
+inline uint8_t checkedOp(uint8_t op) {
+  switch (op) {
+#define PIPS_CHECKED_CASE(name) \
+  case OpCode::name##_NUM:      \
+    return OpCode::name;
+    PIPS_UNCHECKED_OPCODES(PIPS_CHECKED_CASE)
+#undef PIPS_CHECKED_CASE
+  default:
+    return op;
+  }
+}
+
+// Wide variants of the instructions whose operand can outgrow its byte or short:
+// CONSTANT_LONG and the local ops take a 24-bit index, the jumps a 32-bit offset.
+// The compiler only emits them for operands that do not fit.
+#define PIPS_WIDE_OPCODES(X) \
+  X(CONSTANT) \
+  X(GET_LOCAL) \
+  X(SET_LOCAL) \
+  X(JUMP_IF_FALSE) \
+  X(JUMP) \
+  X(LOOP)
+
+// Largest index a CONSTANT_LONG, GET_LOCAL_LONG or SET_LOCAL_LONG can encode.
+inline constexpr uint32_t WIDE_INDEX_MAX = (1u << 24) - 1;
+
+// Wide variant of op, or op itself if it has none.
+inline uint8_t wideOp(uint8_t op) {
+  switch (op) {
+#define PIPS_WIDE_CASE(name) \
+  case OpCode::name:         \
+    return OpCode::name##_LONG;
+    PIPS_WIDE_OPCODES(PIPS_WIDE_CASE)
+#undef PIPS_WIDE_CASE
+  default:
+    return op;
+  }
+}
+// Narrow opcode of a wide one, or op itself.
+inline uint8_t narrowOp(uint8_t op) {
+  switch (op) {
+#define PIPS_NARROW_CASE(name) \
+  case OpCode::name##_LONG:    \
+    return OpCode::name;
+    PIPS_WIDE_OPCODES(PIPS_NARROW_CASE)
+#undef PIPS_NARROW_CASE
+  default:
+    return op;
+  }
+}
+
+// Size of an encoded instruction in bytes, opcode included.
+inline int instructionLength(uint8_t op) {
+  switch (op) {
+  case OpCode::CONSTANT:
+  case OpCode::GET_LOCAL:
+  case OpCode::SET_LOCAL:
+  case OpCode::GET_INPUT:
+    return 2;
+  case OpCode::DEFINE_GLOBAL:
+  case OpCode::GET_GLOBAL:
+  case OpCode::SET_GLOBAL:
+  case OpCode::JUMP_IF_FALSE:
+  case OpCode::JUMP:
+  case OpCode::LOOP:
+  case OpCode::ADD_LOCAL_CONST:
+  case OpCode::MULTIPLY_LOCALS:
+  case OpCode::SET_LOCAL_CONST:
+  case OpCode::LESS_JUMP_IF_FALSE:
+    return 3;
+  case OpCode::CONSTANT_LONG:
+  case OpCode::GET_LOCAL_LONG:
+  case OpCode::SET_LOCAL_LONG:
+    return 4;
+  case OpCode::JUMP_IF_FALSE_LONG:
+  case OpCode::JUMP_LONG:
+  case OpCode::LOOP_LONG:
+    return 5;
+  default:
+    return 1;
+  }
+}
+
+// Big-endian operand stored in `count` bytes.
+inline uint32_t readOperand(const uint8_t *bytes, int count) {
+  uint32_t operand = 0;
+  for (int k = 0; k < count; k++) operand = (operand << 8) | bytes[k];
+  return operand;
+}
+// Operand of an instruction with a single one (a constant, slot or jump offset), in
+// its narrow or wide encoding.
+template <typename Code>
+inline uint32_t operandAt(const Code &code, size_t i) {
+  return readOperand(&code[i + 1], instructionLength(code[i]) - 1);
+}
+inline bool isJumpOp(uint8_t op) {
+  op = narrowOp(op);
+  return op == OpCode::JUMP || op == OpCode::JUMP_IF_FALSE || op == OpCode::LOOP ||
+         op == OpCode::LESS_JUMP_IF_FALSE;
+}
+// Offset of the instruction the jump at i goes to. Offsets count from the end of the
+// jump; LOOP goes backward.
+template <typename Code>
+inline size_t jumpTarget(const Code &code, size_t i) {
+  const size_t next = i + instructionLength(code[i]);
+  const size_t offset = operandAt(code, i);
+  return (narrowOp(code[i]) == OpCode::LOOP) ? next - offset : next + offset;
+}
+
+// Net change of the stack depth caused by an instruction.
+inline int stackEffect(uint8_t op) {
+  switch (narrowOp(op)) {
+  case OpCode::CONSTANT:
+  case OpCode::NIL:
+  case OpCode::TRUE:
+  case OpCode::FALSE:
+  case OpCode::GET_GLOBAL:
+  case OpCode::GET_LOCAL:
+  case OpCode::GET_INPUT:
+  case OpCode::ADD_LOCAL_CONST:
+  case OpCode::MULTIPLY_LOCALS:
+  case OpCode::SET_LOCAL_CONST:
+    return 1;
+  case OpCode::ADD:
+  case OpCode::SUBTRACT:
+  case OpCode::MULTIPLY:
+  case OpCode::DIVIDE:
+  case OpCode::INTDIVIDE:
+  case OpCode::XOR:
+  case OpCode::BOR:
+  case OpCode::BAND:
+  case OpCode::LSHIFT:
+  case OpCode::RSHIFT:
+  case OpCode::EQUAL:
+  case OpCode::GREATER:
+  case OpCode::LESS:
+  case OpCode::NOT_EQUAL:
+  case OpCode::GREATER_EQUAL:
+  case OpCode::LESS_EQUAL:
+  case OpCode::POW:
+  case OpCode::MOD:
+  case OpCode::ATAN2:
+  case OpCode::MIN:
+  case OpCode::MAX:
+  case OpCode::PRINT:
+  case OpCode::POP:
+  case OpCode::DEFINE_GLOBAL:
+  case OpCode::LESS_JUMP_IF_FALSE:
+  case OpCode::ADD_NUM:
+  case OpCode::SUBTRACT_NUM:
+  case OpCode::MULTIPLY_NUM:
+  case OpCode::DIVIDE_NUM:
+  case OpCode::MOD_NUM:
+  case OpCode::POW_NUM:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Allocator placing the elements of a vector at the start of a cache line.
+template <typename T>
+struct CacheAlignedAllocator {
+  using value_type = T;
+
+  CacheAlignedAllocator() = default;
+  template <typename U>
+  CacheAlignedAllocator(const CacheAlignedAllocator<U> &) {}
 
+  T *allocate(size_t n) {
+    return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(CACHE_LINE_SIZE)));
+  }
+  void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t(CACHE_LINE_SIZE)); }
+  template <typename U>
+  bool operator==(const CacheAlignedAllocator<U> &) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const CacheAlignedAllocator<U> &) const {
+    return false;
+  }
+};
+
+// Source line of each unit of some code (a byte of a chunk, an instruction of
+// register code), stored as runs: a unit has the line of the last run starting at
+// or before it. Consecutive units nearly always share a line, and lines are only
+// read to report errors and disassemble, so they are looked up by binary search.
+struct LineTable {
+  struct Run {
+    uint32_t start;
+    int32_t line;
+  };
+  std::vector<Run> runs;
+
+  // Record the line of unit `at`, which follows all the units added so far.
+  void add(size_t at, int line) {
+    if (runs.empty() || runs.back().line != line) {
+      runs.push_back({static_cast<uint32_t>(at), static_cast<int32_t>(line)});
+    }
+  }
+  int lineAt(size_t at) const {
+    auto run = std::upper_bound(runs.begin(), runs.end(), at,
+                                [](size_t offset, const Run &r) { return offset < r.start; });
+    return (run == runs.begin()) ? 0 : std::prev(run)->line;
+  }
+  // Drop the lines of the units from `size` on.
+  void truncate(size_t size) {
+    while (!runs.empty() && runs.back().start >= size) runs.pop_back();
+  }
+  void clear() { runs.clear(); }
+};
+
+template <typename Real = DefaultReal>
 struct Chunk {
-  std::vector<uint8_t> code;
-  std::vector<Value> constants;
-  std::vector<int> lines;
+  using Value = pips::Value<Real>;
+
+  // What the interpreter reads, each starting on a cache line.
+  std::vector<uint8_t, CacheAlignedAllocator<uint8_t>> code;
+  std::vector<Value, CacheAlignedAllocator<Value>> constants;
+  LineTable lines;
+  // Largest number of values the code keeps on the stack, locals included. Set
+  // whenever the code is generated or loaded; a context makes room for it before
+  // running the chunk, so pushes need no bounds checks.
+  int maxDepth = 0;
 
   Chunk() {
-    code.reserve(8);
+    code.reserve(CACHE_LINE_SIZE);
     constants.reserve(8);
-    lines.reserve(8);
   }
 
   ~Chunk() = default;
 
   void write(const uint8_t byte, const int line) {
+    lines.add(code.size(), line);
     code.push_back(byte);
-    lines.push_back(line);
+  }
+
+  // Drop the code from `size` on.
+  void truncate(size_t size) {
+    code.resize(size);
+    lines.truncate(size);
+  }
+  int lineAt(size_t offset) const { return lines.lineAt(offset); }
+  // Empty the chunk, keeping the memory of its vectors.
+  void clear() {
+    code.clear();
+    constants.clear();
+    lines.clear();
+    maxDepth = 0;
   }
 
   int addConstant(Value val) {
     constants.push_back(val);
     return constants.size() - 1;
   }
+  // Follows every path through the code to find its largest stack depth. Returns -1
+  // if a path pops more than it pushed, paths join at different depths, a jump
+  // leaves the code or a path reaches a byte that is not an opcode. The depth before
+  // each instruction goes to `depths` when given, -1 where no path reaches.
+  int computeMaxDepth(ArenaVector<int> *depths = nullptr) const {
+    ArenaVector<int> local;
+    ArenaVector<int> &depthAt = depths ? *depths : local;
+    depthAt.assign(code.size(), -1);
+    ArenaVector<size_t> work;
+    int deepest = 0;
+    auto reach = [&](size_t i, int depth) {
+      if (i >= code.size()) return false;
+      if (depthAt[i] < 0) {
+        depthAt[i] = depth;
+        work.push_back(i);
+      }
+      return depthAt[i] == depth;
+    };
+    if (code.empty()) return 0;
+    reach(0, 0);
+    while (!work.empty()) {
+      const size_t i = work.back();
+      work.pop_back();
+      const uint8_t op = code[i];
+      if (op >= OPCODE_COUNT || i + instructionLength(op) > code.size()) return -1;
+      if (op == OpCode::RETURN) continue;
+      const int depth = depthAt[i] + stackEffect(op);
+      if (depth < 0) return -1;
+      deepest = std::max(deepest, depth);
+      if (isJumpOp(op) && !reach(jumpTarget(code, i), depth)) return -1;
+      if (narrowOp(op) != OpCode::JUMP && narrowOp(op) != OpCode::LOOP &&
+          !reach(i + instructionLength(op), depth)) {
+        return -1;
+      }
+    }
+    return deepest;
+  }
   template <OpCode OP>
-  int Instruction(std::string name, int i) {
-
-    if constexpr (!is_ConstOp<OP>()) {
-      printf("%s\n", name.c_str());
-      return i + 1;
-    } else if constexpr (is_ByteOp<OP>()) {
+  int Instruction(std::string name, int i) const {
+    if constexpr (is_ByteOp<OP>()) {
       uint8_t slot = code[i + 1];
-      printf("%-16s %4d\n", name, slot);
+      printf("%-16s %4d\n", name.c_str(), slot);
       return i + 2;
-    } else {
+    } else if constexpr (is_GlobalOp<OP>()) {
+      uint16_t slot = static_cast<uint16_t>((code[i + 1] << 8) | code[i + 2]);
+      printf("%-16s %4d\n", name.c_str(), slot);
+      return i + 3;
+    } else if constexpr (is_ConstOp<OP>()) {
       const auto &constant = code[i + 1];
       printf("%-16s %4d '", name.c_str(), constant);
       printValue(constants[constant]);
       printf("'\n");
       return i + 2;
+    } else {
+      printf("%s\n", name.c_str());
+      return i + 1;
+    }
+  }
+  int jumpInstruction(const char *name, int offset) const {
+    printf("%-16s %4d -> %zu\n", name, offset, jumpTarget(code, offset));
+    return offset + instructionLength(code[offset]);
+  }
+  // CONSTANT_LONG, GET_LOCAL_LONG and SET_LOCAL_LONG.
+  int wideInstruction(const char *name, bool constant, int i) const {
+    const uint32_t index = operandAt(code, i);
+    printf("%-16s %4u", name, index);
+    if (constant) {
+      printf(" '");
+      printValue(constants[index]);
+      printf("'");
     }
-    return i + 1;
+    printf("\n");
+    return i + 4;
   }
-  int jumpInstruction(const char *name, int sign, int offset) {
-    uint16_t jump = static_cast<uint16_t>(code[offset + 1] << 8);
-    jump |= code[offset + 2];
-    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
-    return offset + 3;
+  // Superinstructions with a local slot and a constant or a second slot.
+  int fusedInstruction(const char *name, bool constant, int i) const {
+    printf("%-16s %4d", name, code[i + 1]);
+    if (constant) {
+      printf(" %4d '", code[i + 2]);
+      printValue(constants[code[i + 2]]);
+      printf("'\n");
+    } else {
+      printf(" %4d\n", code[i + 2]);
+    }
+    return i + 3;
   }
-  int disassembleInstruction(int i) {
+  int disassembleInstruction(int i) const {
     printf("%04d ", i);
     const auto &byte = code[i];
-    if ((i > 0) && (lines[i] == lines[i - 1])) {
+    if ((i > 0) && (lineAt(i) == lineAt(i - 1))) {
       printf("   | ");
     } else {
-      printf("%4d ", lines[i]);
+      printf("%4d ", lineAt(i));
     }
 
     switch (byte) {
@@ -169,6 +536,12 @@ struct Chunk {
       return Instruction<OpCode::GREATER>("OP_GREATER", i);
     case OpCode::LESS:
       return Instruction<OpCode::LESS>("OP_LESS", i);
+    case OpCode::NOT_EQUAL:
+      return Instruction<OpCode::NOT_EQUAL>("OP_NOT_EQUAL", i);
+    case OpCode::GREATER_EQUAL:
+      return Instruction<OpCode::GREATER_EQUAL>("OP_GREATER_EQUAL", i);
+    case OpCode::LESS_EQUAL:
+      return Instruction<OpCode::LESS_EQUAL>("OP_LESS_EQUAL", i);
     case OpCode::EXP:
       return Instruction<OpCode::EXP>("OP_EXP", i);
     case OpCode::SIN:
@@ -223,20 +596,56 @@ struct Chunk {
       return Instruction<OpCode::SET_GLOBAL>("OP_SET_GLOBAL", i);
     case OpCode::GET_LOCAL:
       return Instruction<OpCode::GET_LOCAL>("OP_GET_LOCAL", i);
+    case OpCode::GET_INPUT:
+      return Instruction<OpCode::GET_INPUT>("OP_GET_INPUT", i);
     case OpCode::SET_LOCAL:
       return Instruction<OpCode::SET_LOCAL>("OP_SET_LOCAL", i);
     case OpCode::JUMP:
-      return jumpInstruction("OP_JUMP", 1, i);
+      return jumpInstruction("OP_JUMP", i);
     case OpCode::JUMP_IF_FALSE:
-      return jumpInstruction("OP_JUMP_IF_FALSE", 1, i);
+      return jumpInstruction("OP_JUMP_IF_FALSE", i);
     case OpCode::LOOP:
-      return jumpInstruction("OP_LOOP", -1, i);
+      return jumpInstruction("OP_LOOP", i);
+    case OpCode::CONSTANT_LONG:
+      return wideInstruction("OP_CONSTANT_LONG", true, i);
+    case OpCode::GET_LOCAL_LONG:
+      return wideInstruction("OP_GET_LOCAL_LONG", false, i);
+    case OpCode::SET_LOCAL_LONG:
+      return wideInstruction("OP_SET_LOCAL_LONG", false, i);
+    case OpCode::JUMP_LONG:
+      return jumpInstruction("OP_JUMP_LONG", i);
+    case OpCode::JUMP_IF_FALSE_LONG:
+      return jumpInstruction("OP_JUMP_IF_FALSE_LONG", i);
+    case OpCode::LOOP_LONG:
+      return jumpInstruction("OP_LOOP_LONG", i);
+    case OpCode::ADD_LOCAL_CONST:
+      return fusedInstruction("OP_ADD_LOCAL_CONST", true, i);
+    case OpCode::MULTIPLY_LOCALS:
+      return fusedInstruction("OP_MULTIPLY_LOCALS", false, i);
+    case OpCode::SET_LOCAL_CONST:
+      return fusedInstruction("OP_SET_LOCAL_CONST", true, i);
+    case OpCode::LESS_JUMP_IF_FALSE:
+      return jumpInstruction("OP_LESS_JUMP_IF_FALSE", i);
+    case OpCode::ADD_NUM:
+      return Instruction<OpCode::ADD_NUM>("OP_ADD_NUM", i);
+    case OpCode::SUBTRACT_NUM:
+      return Instruction<OpCode::SUBTRACT_NUM>("OP_SUBTRACT_NUM", i);
+    case OpCode::MULTIPLY_NUM:
+      return Instruction<OpCode::MULTIPLY_NUM>("OP_MULTIPLY_NUM", i);
+    case OpCode::DIVIDE_NUM:
+      return Instruction<OpCode::DIVIDE_NUM>("OP_DIVIDE_NUM", i);
+    case OpCode::MOD_NUM:
+      return Instruction<OpCode::MOD_NUM>("OP_MOD_NUM", i);
+    case OpCode::POW_NUM:
+      return Instruction<OpCode::POW_NUM>("OP_POW_NUM", i);
+    case OpCode::NEGATE_NUM:
+      return Instruction<OpCode::NEGATE_NUM>("OP_NEGATE_NUM", i);
     default:
       printf("Unknown opcode ??\n");
       return i + 1;
     }
   }
-  void disassemble(std::string name) {
+  void disassemble(std::string name) const {
     printf("== %s ==\n", name.c_str());
     for (int i = 0; i < code.size();) {
       i = disassembleInstruction(i);
@@ -0,0 +1,317 @@
+#ifndef PIPS_CODEGEN_HPP_
+#define PIPS_CODEGEN_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "chunk.hpp"
+#include "numeric.hpp"
+#include "program.hpp"
+#include "value.hpp"
+
+namespace pips {
+
+// Ahead-of-time translation of numeric programs (see NumericAnalysis) to C++. Each
+// program becomes a function
+//   inline double name(const double *inputs)
+// where inputs[i] is the value of the program's input i and the result is the value
+// the script returns, with booleans as 1 or 0 and nil as 0. The function computes
+// exactly what VM::run computes: it uses pips::sin, cos and tan, and the same
+// integer conversions for % and //. Output is compiled with the pips headers on the
+// include path, after the includes from prelude().
+//
+// Stack slots become variables s0, s1, ...; operations are nested into expressions
+// until a value is stored to a local, needed at a jump or read more than once.
+template <typename Real = DefaultReal>
+struct CppGenerator {
+  using Chunk = pips::Chunk<Real>;
+  using Analysis = NumericAnalysis<Real>;
+
+  // An expression for the value of a stack slot and the locals it reads. Simple
+  // operands (a variable, an input or a literal) are cheap to repeat wherever they
+  // are read.
+  struct Operand {
+    std::string expr;
+    std::vector<int> locals;
+    bool simple;
+  };
+
+  const Chunk *chunk = nullptr;
+  Analysis analysis;
+  std::vector<Operand> operands;
+  std::vector<uint8_t> used;
+  std::string body;
+
+  CppGenerator() = default;
+  ~CppGenerator() = default;
+
+  static std::string prelude() {
+    return "#include <algorithm>\n#include <cmath>\n#include <limits>\n\n"
+           "#include <pips/math.hpp>\n";
+  }
+
+  static std::string slot(int p) { return "s" + std::to_string(p); }
+  static std::string label(size_t i) { return "L" + std::to_string(i); }
+  static std::string literal(double value) {
+    if (std::isnan(value)) return "std::numeric_limits<double>::quiet_NaN()";
+    if (std::isinf(value)) {
+      return value < 0 ? "(-std::numeric_limits<double>::infinity())"
+                       : "std::numeric_limits<double>::infinity()";
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof buffer, "%.17g", value);
+    std::string text = buffer;
+    if (text.find_first_of(".e") == std::string::npos) text += ".0";
+    return (value < 0 || std::signbit(value)) ? "(" + text + ")" : text;
+  }
+  void statement(const std::string &text) { body += "  " + text + "\n"; }
+  bool isSlot(size_t p) const { return operands[p].expr == slot(static_cast<int>(p)); }
+  Operand slotOperand(int p) {
+    used[p] = 1;
+    return {slot(p), {p}, true};
+  }
+  // Store slot p in its variable.
+  void writeBack(size_t p) {
+    if (isSlot(p)) return;
+    const int index = static_cast<int>(p);
+    statement(slot(index) + " = " + operands[p].expr + ";");
+    operands[p] = slotOperand(index);
+  }
+  void flush() {
+    for (size_t p = 0; p < operands.size(); p++) writeBack(p);
+  }
+  // Local `slot` is about to change: slots still reading it need its old value.
+  void detach(int local) {
+    for (size_t p = 0; p < operands.size(); p++) {
+      // The value being stored is read before the assignment.
+      if (static_cast<int>(p) == local || p + 1 == operands.size() || isSlot(p)) continue;
+      for (int read : operands[p].locals) {
+        if (read == local) {
+          writeBack(p);
+          break;
+        }
+      }
+    }
+  }
+  Operand local(int p) {
+    if (!operands[p].simple) writeBack(p);
+    return operands[p];
+  }
+  void setLocal(int p) {
+    detach(p);
+    const Operand value = operands.back();
+    statement(slot(p) + " = " + value.expr + ";");
+    if (static_cast<size_t>(p) + 1 < operands.size()) operands[p] = slotOperand(p);
+    operands.back() = slotOperand(p);
+  }
+  Operand constant(uint32_t index) const {
+    return {literal(static_cast<double>(AS_NUMBER(chunk->constants[index]))), {}, true};
+  }
+
+  // Replace the top `count` slots with `expr` computed from them.
+  void produce(size_t count, std::string expr) {
+    Operand result{std::move(expr), {}, false};
+    for (size_t k = operands.size() - count; k < operands.size(); k++) {
+      result.locals.insert(result.locals.end(), operands[k].locals.begin(),
+                           operands[k].locals.end());
+    }
+    operands.resize(operands.size() - count);
+    operands.push_back(std::move(result));
+  }
+  static std::string flag(const std::string &condition, bool negate = false) {
+    return "(" + condition + (negate ? " ? 0.0 : 1.0)" : " ? 1.0 : 0.0)");
+  }
+  static const char *unaryFunction(uint8_t op) {
+    switch (op) {
+    case OpCode::EXP: return "std::exp";
+    case OpCode::SIN: return "pips::sin";
+    case OpCode::COS: return "pips::cos";
+    case OpCode::TAN: return "pips::tan";
+    case OpCode::ABS: return "std::abs";
+    case OpCode::LOG: return "std::log";
+    case OpCode::LOG10: return "std::log10";
+    case OpCode::SQRT: return "std::sqrt";
+    case OpCode::ACOS: return "std::acos";
+    case OpCode::ASIN: return "std::asin";
+    case OpCode::ATAN: return "std::atan";
+    case OpCode::CEIL: return "std::ceil";
+    case OpCode::FLOOR: return "std::floor";
+    default: return nullptr;
+    }
+  }
+  static std::string binaryExpression(uint8_t op, const std::string &a, const std::string &b) {
+    switch (checkedOp(op)) {
+    case OpCode::ADD: return "(" + a + " + " + b + ")";
+    case OpCode::SUBTRACT: return "(" + a + " - " + b + ")";
+    case OpCode::MULTIPLY: return "(" + a + " * " + b + ")";
+    case OpCode::DIVIDE: return "(" + a + " / " + b + ")";
+    case OpCode::INTDIVIDE:
+      return "static_cast<double>(static_cast<int>(" + a + " / " + b + "))";
+    case OpCode::MOD:
+      return "static_cast<double>(static_cast<int>(" + a + ") % static_cast<int>(" + b + "))";
+    case OpCode::POW: return "std::pow(" + a + ", " + b + ")";
+    case OpCode::ATAN2: return "std::atan2(" + a + ", " + b + ")";
+    case OpCode::MIN: return "std::min(" + a + ", " + b + ")";
+    case OpCode::MAX: return "std::max(" + a + ", " + b + ")";
+    default: return "";
+    }
+  }
+
+  void generateInstruction(size_t i) {
+    const auto &code = chunk->code;
+    const uint8_t op = code[i];
+    const std::string top = operands.empty() ? std::string() : operands.back().expr;
+    if (Analysis::isUnaryMath(op)) {
+      if (op == OpCode::SIGN) {
+        produce(1, "(" + top + " < 0.0 ? -1.0 : 1.0)");
+      } else {
+        produce(1, std::string(unaryFunction(op)) + "(" + top + ")");
+      }
+      return;
+    }
+    if (Analysis::isBinaryMath(op)) {
+      produce(2, binaryExpression(op, operands[operands.size() - 2].expr, top));
+      return;
+    }
+    const auto &types = analysis.typesAt[i];
+    const std::string left = (operands.size() >= 2) ? operands[operands.size() - 2].expr : "";
+    switch (narrowOp(op)) {
+    case OpCode::NEGATE:
+    case OpCode::NEGATE_NUM:
+      produce(1, "(-" + top + ")");
+      break;
+    case OpCode::UPLUS:
+      break;
+    case OpCode::CONSTANT:
+      operands.push_back(constant(operandAt(code, i)));
+      break;
+    case OpCode::TRUE:
+    case OpCode::FALSE:
+      operands.push_back({(op == OpCode::TRUE) ? "1.0" : "0.0", {}, true});
+      break;
+    case OpCode::GET_INPUT:
+      operands.push_back({"inputs[" + std::to_string(code[i + 1]) + "]", {}, true});
+      break;
+    case OpCode::GET_LOCAL:
+      operands.push_back(local(operandAt(code, i)));
+      break;
+    case OpCode::SET_LOCAL:
+      setLocal(operandAt(code, i));
+      break;
+    case OpCode::POP:
+      operands.pop_back();
+      break;
+    case OpCode::LESS:
+      produce(2, flag(left + " < " + top));
+      break;
+    case OpCode::GREATER:
+      produce(2, flag(left + " > " + top));
+      break;
+    // As in the VM, these negate the opposite comparison, so they are true for NaN.
+    case OpCode::GREATER_EQUAL:
+      produce(2, flag(left + " < " + top, true));
+      break;
+    case OpCode::LESS_EQUAL:
+      produce(2, flag(left + " > " + top, true));
+      break;
+    case OpCode::EQUAL:
+    case OpCode::NOT_EQUAL:
+      if (types[types.size() - 2] != types.back()) {
+        // A number never equals a boolean.
+        produce(2, (op == OpCode::EQUAL) ? "0.0" : "1.0");
+        operands.back().locals.clear();
+      } else {
+        produce(2, flag(left + " == " + top, op == OpCode::NOT_EQUAL));
+      }
+      break;
+    case OpCode::NOT:
+      // Falsey values are false and numbers equal to zero.
+      produce(1, flag(top + " == 0.0"));
+      break;
+    case OpCode::JUMP_IF_FALSE:
+      flush();
+      statement("if (" + operands.back().expr + " == 0.0) goto " +
+                label(jumpTarget(code, i)) + ";");
+      break;
+    case OpCode::JUMP:
+    case OpCode::LOOP:
+      flush();
+      statement("goto " + label(jumpTarget(code, i)) + ";");
+      break;
+    case OpCode::ADD_LOCAL_CONST:
+    case OpCode::MULTIPLY_LOCALS: {
+      const bool add = op == OpCode::ADD_LOCAL_CONST;
+      operands.push_back(local(code[i + 1]));
+      operands.push_back(add ? constant(code[i + 2]) : local(code[i + 2]));
+      const size_t n = operands.size();
+      produce(2, binaryExpression(add ? OpCode::ADD : OpCode::MULTIPLY, operands[n - 2].expr,
+                                  operands[n - 1].expr));
+      break;
+    }
+    case OpCode::SET_LOCAL_CONST:
+      operands.push_back(constant(code[i + 2]));
+      setLocal(code[i + 1]);
+      break;
+    case OpCode::LESS_JUMP_IF_FALSE:
+      produce(2, flag(left + " < " + top));
+      flush();
+      statement("if (" + operands.back().expr + " == 0.0) goto " +
+                label(jumpTarget(code, i)) + ";");
+      break;
+    case OpCode::RETURN:
+      statement("return " + (operands.empty() ? std::string("0.0") : top) + ";");
+      break;
+    }
+  }
+
+  // C++ source of the function `name` computing `program`, or an empty string if the
+  // program is not numeric.
+  std::string generate(const Program<Real> &program, const std::string &name) {
+    chunk = &program.chunk;
+    if (!analysis.analyze(program.chunk)) return "";
+    operands.clear();
+    used.assign(analysis.maxDepth, 0);
+    body.clear();
+    bool fallsThrough = true;
+    for (size_t i = 0; i < chunk->code.size(); i += instructionLength(chunk->code[i])) {
+      if (!analysis.reached[i]) continue;
+      if (analysis.targets[i]) {
+        if (fallsThrough) flush();
+        operands.clear();
+        for (size_t p = 0; p < analysis.typesAt[i].size(); p++) {
+          operands.push_back(slotOperand(static_cast<int>(p)));
+        }
+        body += label(i) + ":;\n";
+      }
+      generateInstruction(i);
+      const uint8_t op = narrowOp(chunk->code[i]);
+      fallsThrough = op != OpCode::JUMP && op != OpCode::LOOP && op != OpCode::RETURN;
+    }
+
+    std::string source = "// Generated by pips.";
+    if (!program.inputs.empty()) {
+      source += " Inputs:";
+      for (size_t k = 0; k < program.inputs.size(); k++) {
+        source += " [" + std::to_string(k) + "] " + program.inputs[k];
+      }
+      source += ".";
+    }
+    source += "\ninline double " + name + "(const double *inputs) {\n";
+    if (body.find("inputs[") == std::string::npos) source += "  (void)inputs;\n";
+    // Stores to locals the script never reads again are kept.
+    std::string slots;
+    for (size_t p = 0; p < used.size(); p++) {
+      if (!used[p]) continue;
+      slots += (slots.empty() ? "  [[maybe_unused]] double " : ", ") +
+               slot(static_cast<int>(p)) + " = 0.0";
+    }
+    if (!slots.empty()) source += slots + ";\n";
+    return source + body + "}\n";
+  }
+};
+
+} // namespace pips
+#endif // PIPS_CODEGEN_HPP_
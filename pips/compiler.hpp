@@ -9,12 +9,19 @@
 // The code was adapted for C++ and simplified in many ways.
 //===========================================================================
 
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <limits>
+#include <string>
+#include <string_view>
 #include <tuple>
+#include <vector>
 
 #include "types.hpp"
+#include "arena.hpp"
 #include "chunk.hpp"
+#include "math.hpp"
 #include "scanner.hpp"
 #include "utils.hpp"
 #include "value.hpp"
@@ -93,14 +100,21 @@ struct Parser {
   }
 };
 
+template <typename Real>
 struct VM;
 
 struct Local {
   Token name;
   int depth;
+  // Index of the local's entry in Compiler::localTypes.
+  int type;
 };
 
+template <typename Real = DefaultReal>
 struct Compiler {
+  using Value = pips::Value<Real>;
+  using Chunk = pips::Chunk<Real>;
+  using VM = pips::VM<Real>;
 
   // scanner maybe needs to be a unique_ptr?
   Scanner scanner;
@@ -109,10 +123,46 @@ struct Compiler {
   VM *pvm;
   Compiler *current;
   char end_line = ';';
+  // Names of the input variables declared for this program, if any.
+  const std::vector<std::string> *inputs = nullptr;
 
-  Local locals[UINT8_MAX + 1];
+  // Locals in scope are the first localCount entries; the vector only grows.
+  ArenaVector<Local> locals;
   int localCount;
   int scopeDepth;
+  // Offset of the POP ending the latest top-level expression statement. If it is
+  // the last instruction of the script, the value is kept as the script's result.
+  int resultPop = -1;
+  // Offset the latest patched forward jump lands on.
+  int lastJumpTarget = -1;
+  // Offsets of the CONSTANT instructions pushing numbers, in emission order. An
+  // operator applied to the ones at the end of the code is folded at compile time.
+  ArenaVector<int> numberConstants;
+  // Forward jumps are emitted with 16-bit offsets, except those flagged here (by
+  // emission order), which get 32-bit ones. A jump found too long while patching is
+  // flagged and jumpsWidened set: the source must then be compiled again with the
+  // updated flags (see VM::compile).
+  std::vector<uint8_t> longJumps;
+  ArenaVector<int> jumpOffsets;
+  bool jumpsWidened = false;
+
+  // What is known about the value an expression leaves on the stack: it is a
+  // number as long as the locals in `locals` only ever hold numbers.
+  struct StaticType {
+    bool number = false;
+    ArenaVector<int> locals;
+  };
+  // Whether a local only ever holds numbers, the locals its assigned values came
+  // from, and the unchecked instructions relying on it. Entries are never reused,
+  // since code compiled for a local can run again after its scope has ended.
+  struct LocalType {
+    bool number = false;
+    ArenaVector<int> sources;
+    ArenaVector<int> uses;
+  };
+  // Type of the expression compiled last. Every parse rule sets it.
+  StaticType lastType;
+  ArenaVector<LocalType> localTypes;
 
   // clang-format off
   std::array<Precedence, 14> prec_array{
@@ -362,16 +412,178 @@ struct Compiler {
     emitByte(byte1);
     emitByte(byte2);
   }
-  uint8_t makeConstant(Value val) {
+  void emitGlobal(uint8_t op, uint16_t slot) {
+    emitByte(op);
+    emitByte((slot >> 8) & 0xff);
+    emitByte(slot & 0xff);
+  }
+  // Emits op with a constant index or local slot, in the wide encoding if it does
+  // not fit a byte.
+  void emitIndexed(uint8_t op, uint32_t index) {
+    if (index <= UINT8_MAX) {
+      emitBytes(op, static_cast<uint8_t>(index));
+      return;
+    }
+    emitByte(wideOp(op));
+    emitByte((index >> 16) & 0xff);
+    emitByte((index >> 8) & 0xff);
+    emitByte(index & 0xff);
+  }
+  uint32_t makeConstant(Value val) {
     auto constant = currentChunk()->addConstant(val);
-    if (constant > Utils::Big<uint8_t>()) {
+    if (constant > static_cast<int>(WIDE_INDEX_MAX)) {
       parser.error("Too many constants in one chunk.");
       return 0;
     }
-    return static_cast<uint8_t>(constant);
+    return static_cast<uint32_t>(constant);
   }
   void emitReturn() { emitByte(OpCode::RETURN); }
-  void emitConstant(Value val) { emitBytes(OpCode::CONSTANT, makeConstant(val)); }
+  void emitConstant(Value val) { emitIndexed(OpCode::CONSTANT, makeConstant(val)); }
+  void emitNumber(Real value) {
+    numberConstants.push_back(static_cast<int>(currentChunk()->code.size()));
+    emitConstant(NUMBER_VAL(value));
+    lastType = StaticType{true, {}};
+  }
+
+  // Computes op on constant operands the way the VM would. Returns false for
+  // operators that are not folded and for operands the VM does not define a
+  // result for (integer conversions out of range, or INT_MIN % -1 overflowing).
+  static bool foldNumber(uint8_t op, Real a, Real b, Real &result) {
+    const auto isInt = [](Real x) {
+      return x > Real(std::numeric_limits<int>::min()) - 1 &&
+             x < Real(std::numeric_limits<int>::max()) + 1;
+    };
+    switch (op) {
+    case OpCode::NEGATE: result = -a; return true;
+    case OpCode::UPLUS: result = a; return true;
+    case OpCode::EXP: result = std::exp(a); return true;
+    case OpCode::SIN: result = pips::sin(a); return true;
+    case OpCode::COS: result = pips::cos(a); return true;
+    case OpCode::TAN: result = pips::tan(a); return true;
+    case OpCode::ABS: result = std::abs(a); return true;
+    case OpCode::LOG: result = std::log(a); return true;
+    case OpCode::LOG10: result = std::log10(a); return true;
+    case OpCode::SIGN: result = (a < Real(0) ? Real(-1) : Real(1)); return true;
+    case OpCode::SQRT: result = std::sqrt(a); return true;
+    case OpCode::ACOS: result = std::acos(a); return true;
+    case OpCode::ASIN: result = std::asin(a); return true;
+    case OpCode::ATAN: result = std::atan(a); return true;
+    case OpCode::CEIL: result = std::ceil(a); return true;
+    case OpCode::FLOOR: result = std::floor(a); return true;
+    case OpCode::ADD: result = a + b; return true;
+    case OpCode::SUBTRACT: result = a - b; return true;
+    case OpCode::MULTIPLY: result = a * b; return true;
+    case OpCode::DIVIDE: result = a / b; return true;
+    case OpCode::POW: result = std::pow(a, b); return true;
+    case OpCode::ATAN2: result = std::atan2(a, b); return true;
+    case OpCode::MIN: result = std::min(a, b); return true;
+    case OpCode::MAX: result = std::max(a, b); return true;
+    case OpCode::INTDIVIDE:
+      if (!isInt(a / b)) return false;
+      result = static_cast<Real>(static_cast<int>(a / b));
+      return true;
+    case OpCode::MOD:
+      if (!isInt(a) || !isInt(b) || static_cast<int>(b) == 0) return false;
+      if (static_cast<int>(a) == std::numeric_limits<int>::min() && static_cast<int>(b) == -1) {
+        return false;
+      }
+      result = static_cast<Real>(static_cast<int>(a) % static_cast<int>(b));
+      return true;
+    default:
+      return false;
+    }
+  }
+  static int arity(uint8_t op) {
+    switch (op) {
+    case OpCode::ADD:
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE:
+    case OpCode::INTDIVIDE:
+    case OpCode::MOD:
+    case OpCode::POW:
+    case OpCode::ATAN2:
+    case OpCode::MIN:
+    case OpCode::MAX:
+      return 2;
+    default:
+      return 1;
+    }
+  }
+  // Replaces the operands of op with the result when they are the number constants
+  // last emitted and no jump lands between them (as after `c ? 1 : 2`).
+  bool fold(uint8_t op) {
+    auto chunk = currentChunk();
+    const int count = arity(op);
+    const int n = static_cast<int>(numberConstants.size());
+    if (n < count) return false;
+    // The operands are constants emitted back to back at the end of the code.
+    const int start = numberConstants[n - count];
+    if (lastJumpTarget > start) return false;
+    uint32_t operands[2] = {0, 0};
+    for (int k = 0; k < count; k++) {
+      const int at = numberConstants[n - count + k];
+      const int end = (k + 1 < count) ? numberConstants[n - count + k + 1]
+                                      : static_cast<int>(chunk->code.size());
+      if (end - at != instructionLength(chunk->code[at])) return false;
+      operands[k] = operandAt(chunk->code, at);
+    }
+    Real result;
+    if (!foldNumber(op, AS_NUMBER(chunk->constants[operands[0]]),
+                    AS_NUMBER(chunk->constants[operands[count - 1]]), result)) {
+      return false;
+    }
+    // The operands were usually the last constants added; reuse their entries.
+    for (int k = count - 1; k >= 0; k--) {
+      if (operands[k] + 1u == chunk->constants.size()) chunk->constants.pop_back();
+    }
+    numberConstants.resize(n - count);
+    chunk->truncate(start);
+    emitNumber(result);
+    return true;
+  }
+  // Emits a numeric operator, folded if possible and unchecked if `operands` are
+  // known to be numbers. Every such operator yields a number, except + which can
+  // also concatenate strings.
+  void emitFolded(uint8_t op, const StaticType &operands = StaticType{}) {
+    if (fold(op)) return;
+    const uint8_t unchecked = operands.number ? uncheckedOp(op) : op;
+    emitByte(unchecked);
+    if (unchecked != op) {
+      const int use = static_cast<int>(currentChunk()->code.size()) - 1;
+      for (int local : operands.locals) localTypes[local].uses.push_back(use);
+    }
+    lastType = (op == OpCode::ADD) ? operands : StaticType{true, {}};
+  }
+  static StaticType bothTypes(const StaticType &a, const StaticType &b) {
+    StaticType both{a.number && b.number, a.locals};
+    if (both.number) both.locals.insert(both.locals.end(), b.locals.begin(), b.locals.end());
+    return both;
+  }
+  // A value that is not known to be a number was stored in a local: its unchecked
+  // uses go back to the checked opcodes, as do those of locals assigned from it.
+  void demote(int type) {
+    auto &local = localTypes[type];
+    if (!local.number) return;
+    local.number = false;
+    auto &code = currentChunk()->code;
+    for (int use : local.uses) code[use] = checkedOp(code[use]);
+    for (size_t other = 0; other < localTypes.size(); other++) {
+      const auto &sources = localTypes[other].sources;
+      if (std::find(sources.begin(), sources.end(), type) != sources.end()) {
+        demote(static_cast<int>(other));
+      }
+    }
+  }
+  // The value of lastType is stored in the local.
+  void assignType(int type) {
+    auto &local = localTypes[type];
+    if (!lastType.number) {
+      demote(type);
+      return;
+    }
+    local.sources.insert(local.sources.end(), lastType.locals.begin(), lastType.locals.end());
+  }
 
   void parsePrecedence(Precedence precedence) {
     parser.advance();
@@ -404,13 +616,18 @@ struct Compiler {
   }
   void expression() { parsePrecedence(Precedence::ASSIGNMENT); }
   void addLocal(Token name) {
-    if (current->localCount == UINT8_MAX + 1) {
+    if (current->localCount == static_cast<int>(WIDE_INDEX_MAX) + 1) {
       parser.error("Too many local variables in function");
       return;
     }
+    if (current->localCount == static_cast<int>(current->locals.size())) {
+      current->locals.emplace_back();
+    }
     Local *local = &current->locals[current->localCount++];
     local->name = name;
     local->depth = current->scopeDepth;
+    local->type = static_cast<int>(localTypes.size());
+    localTypes.push_back(LocalType{});
   }
   bool identifiersEqual(Token *a, Token *b) {
     if (a->length != b->length) return false;
@@ -438,49 +655,64 @@ struct Compiler {
     //   return statement();
     //}
     declareVariable();
-    uint8_t global = (current->scopeDepth > 0) ? 0 : identifierConstant(&parser.previous);
+    uint16_t global = (current->scopeDepth > 0) ? 0 : globalSlot(&parser.previous);
     if (match(TokenType::EQUAL)) {
       expression();
     } else {
       emitByte(OpCode::NIL);
+      lastType = StaticType{};
     }
     if (end_line == ';')
       parser.consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
     defineVariable(global);
   }
   void varDeclaration() {
-    auto global = parseVariable("Expect variable name.");
+    uint16_t global = parseVariable("Expect variable name.");
     if (match(TokenType::EQUAL)) {
       expression();
     } else {
       emitByte(OpCode::NIL);
+      lastType = StaticType{};
     }
     if (end_line == ';')
       parser.consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
     defineVariable(global);
   }
 
-  uint8_t identifierConstant(Token *name) {
-    Value val;
-    val.type = ValueType::STRING;
-    name->copy(val.as.str);
-    return makeConstant(val);
+  // Globals are interned to dense slots in the VM's global table at compile time.
+  uint16_t globalSlot(Token *name) {
+    int slot = pvm->globalNames->resolve(std::string_view(name->start, name->length));
+    if (slot < 0) {
+      parser.error("Too many global variables.");
+      return 0;
+    }
+    return static_cast<uint16_t>(slot);
   }
-  uint8_t parseVariable(const char *msg) {
+  uint16_t parseVariable(const char *msg) {
     parser.consume(TokenType::IDENTIFIER, msg);
     declareVariable();
     if (current->scopeDepth > 0) return 0;
-    return identifierConstant(&parser.previous);
+    return globalSlot(&parser.previous);
   }
   void markInitialized() {
-    current->locals[current->localCount - 1].depth = current->scopeDepth;
+    Local &local = current->locals[current->localCount - 1];
+    local.depth = current->scopeDepth;
+    localTypes[local.type] = LocalType{lastType.number, lastType.locals, {}};
   }
-  void defineVariable(uint8_t global) {
+  void defineVariable(uint16_t global) {
     if (current->scopeDepth > 0) {
       markInitialized();
       return;
     }
-    emitBytes(OpCode::DEFINE_GLOBAL, global);
+    emitGlobal(OpCode::DEFINE_GLOBAL, global);
+  }
+  int resolveInput(Token *name) {
+    if (inputs == nullptr) return -1;
+    const std::string_view id(name->start, name->length);
+    for (size_t i = 0; i < inputs->size(); i++) {
+      if ((*inputs)[i] == id) return static_cast<int>(i);
+    }
+    return -1;
   }
   int resolveLocal(Compiler *comp, Token *name) {
     for (int i = comp->localCount - 1; i >= 0; i--) {
@@ -495,21 +727,35 @@ struct Compiler {
     return -1;
   }
   void namedVariable(Token name, bool canAssign) {
-    uint8_t getOp, setOp;
     int arg = resolveLocal(current, &name);
     if (arg != -1) {
-      getOp = OpCode::GET_LOCAL;
-      setOp = OpCode::SET_LOCAL;
-    } else {
-      arg = identifierConstant(&name);
-      getOp = OpCode::GET_GLOBAL;
-      setOp = OpCode::SET_GLOBAL;
+      const int type = current->locals[arg].type;
+      if (canAssign && match(TokenType::EQUAL)) {
+        expression();
+        assignType(type);
+        emitIndexed(OpCode::SET_LOCAL, arg);
+      } else {
+        emitIndexed(OpCode::GET_LOCAL, arg);
+        lastType = localTypes[type].number ? StaticType{true, {type}} : StaticType{};
+      }
+      return;
     }
+    lastType = StaticType{};
+    arg = resolveInput(&name);
+    if (arg != -1) {
+      if (canAssign && match(TokenType::EQUAL)) {
+        parser.error("Can't assign to an input variable.");
+        return;
+      }
+      emitBytes(OpCode::GET_INPUT, (uint8_t)arg);
+      return;
+    }
+    uint16_t slot = globalSlot(&name);
     if (canAssign && match(TokenType::EQUAL)) {
       expression();
-      emitBytes(setOp, (uint8_t)arg);
+      emitGlobal(OpCode::SET_GLOBAL, slot);
     } else {
-      emitBytes(getOp, (uint8_t)arg);
+      emitGlobal(OpCode::GET_GLOBAL, slot);
     }
   }
   void and_(bool tmp_) {
@@ -517,6 +763,7 @@ struct Compiler {
     emitByte(OpCode::POP);
     parsePrecedence(Precedence::AND);
     patchJump(endJump);
+    lastType = StaticType{};
   }
   void or_(bool tmp) {
     int elseJump = emitJump(OpCode::JUMP_IF_FALSE);
@@ -527,61 +774,61 @@ struct Compiler {
 
     parsePrecedence(Precedence::OR);
     patchJump(endJump);
+    lastType = StaticType{};
   }
   void variable(bool canAssign) { namedVariable(parser.previous, canAssign); }
   void number(bool tmp_) {
-    Real value =
-        static_cast<Real>(std::strtod(parser.previous.start, NULL));
-    emitConstant(NUMBER_VAL(value));
+    Real value = Utils::parseReal<Real>(parser.previous.start);
+    emitNumber(value);
   }
-  void getPI(bool tmp_) { emitConstant(NUMBER_VAL(std::acos(-1.0L))); }
+  void getPI(bool tmp_) { emitNumber(std::acos(Real(-1))); }
   void exp(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::EXP);
+    emitFolded(OpCode::EXP);
   }
   void sin(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::SIN);
+    emitFolded(OpCode::SIN);
   }
   void cos(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::COS);
+    emitFolded(OpCode::COS);
   }
   void tan(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::TAN);
+    emitFolded(OpCode::TAN);
   }
   void abs(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::ABS);
+    emitFolded(OpCode::ABS);
   }
   void log(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::LOG);
+    emitFolded(OpCode::LOG);
   }
   void log10(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::LOG10);
+    emitFolded(OpCode::LOG10);
   }
   void sign(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::SIGN);
+    emitFolded(OpCode::SIGN);
   }
   void sqrt(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::SQRT);
+    emitFolded(OpCode::SQRT);
   }
   void acos(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::ACOS);
+    emitFolded(OpCode::ACOS);
   }
   void asin(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::ASIN);
+    emitFolded(OpCode::ASIN);
   }
   void atan(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::ATAN);
+    emitFolded(OpCode::ATAN);
   }
   void binary_consume() {
     parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'atan'.");
@@ -592,23 +839,23 @@ struct Compiler {
   }
   void atan2(bool tmp_) {
     binary_consume();
-    emitByte(OpCode::ATAN2);
+    emitFolded(OpCode::ATAN2);
   }
   void min(bool tmp_) {
     binary_consume();
-    emitByte(OpCode::MIN);
+    emitFolded(OpCode::MIN);
   }
   void max(bool tmp_) {
     binary_consume();
-    emitByte(OpCode::MAX);
+    emitFolded(OpCode::MAX);
   }
   void ceil(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::CEIL);
+    emitFolded(OpCode::CEIL);
   }
   void floor(bool tmp_) {
     parsePrecedence(Precedence::UNARY);
-    emitByte(OpCode::FLOOR);
+    emitFolded(OpCode::FLOOR);
   }
   void grouping(bool tmp_) {
     expression();
@@ -619,16 +866,18 @@ struct Compiler {
     parsePrecedence(Precedence::UNARY);
     switch (op_type) {
     case TokenType::MINUS:
-      emitByte(OpCode::NEGATE);
+      emitFolded(OpCode::NEGATE, lastType);
       break;
     case TokenType::PLUS:
-      emitByte(OpCode::UPLUS);
+      emitFolded(OpCode::UPLUS);
       break;
     case TokenType::BNOT:
       emitByte(OpCode::BNOT);
+      lastType = StaticType{};
       break;
     case TokenType::BANG:
       emitByte(OpCode::NOT);
+      lastType = StaticType{};
       break;
     default:
       break;
@@ -638,12 +887,16 @@ struct Compiler {
   void binary(bool tmp_) {
     TokenType op_type = parser.previous.type;
     const auto &[_f1, _f2, precedence] = getRule(op_type);
+    const StaticType left = lastType;
 
     Precedence next_prec = prec_array[Utils::to_underlying(precedence) + 1];
     parsePrecedence(next_prec);
+    const StaticType operands = bothTypes(left, lastType);
+    // Comparisons and bitwise operators yield booleans or numbers.
+    lastType = StaticType{};
     switch (op_type) {
     case TokenType::PLUS:
-      emitByte(OpCode::ADD);
+      emitFolded(OpCode::ADD, operands);
       break;
     case TokenType::BANG_EQUAL:
       emitBytes(OpCode::EQUAL, OpCode::NOT);
@@ -664,22 +917,22 @@ struct Compiler {
       emitBytes(OpCode::GREATER, OpCode::NOT);
       break;
     case TokenType::MINUS:
-      emitByte(OpCode::SUBTRACT);
+      emitFolded(OpCode::SUBTRACT, operands);
       break;
     case TokenType::MOD:
-      emitByte(OpCode::MOD);
+      emitFolded(OpCode::MOD, operands);
       break;
     case TokenType::STAR:
-      emitByte(OpCode::MULTIPLY);
+      emitFolded(OpCode::MULTIPLY, operands);
       break;
     case TokenType::STAR_STAR:
-      emitByte(OpCode::POW);
+      emitFolded(OpCode::POW, operands);
       break;
     case TokenType::SLASH:
-      emitByte(OpCode::DIVIDE);
+      emitFolded(OpCode::DIVIDE, operands);
       break;
     case TokenType::SLASH_SLASH:
-      emitByte(OpCode::INTDIVIDE);
+      emitFolded(OpCode::INTDIVIDE, operands);
       break;
     case TokenType::XOR:
       emitByte(OpCode::XOR);
@@ -705,6 +958,7 @@ struct Compiler {
     emitByte(OpCode::POP);
 
     parsePrecedence(Precedence::TERNARY);
+    const StaticType thenType = lastType;
     
     int elseJump = emitJump(OpCode::JUMP);
     patchJump(thenJump);
@@ -713,6 +967,7 @@ struct Compiler {
     parser.consume(TokenType::COLON, "Expect ':' after true expression in ternary operator.");
     
     parsePrecedence(Precedence::TERNARY);
+    lastType = bothTypes(thenType, lastType);
     
     patchJump(elseJump);
   }
@@ -720,14 +975,13 @@ struct Compiler {
     // The +1 and -2 remove the leading and trailing "
     // If we supported strings without the need of " " we would remove that and possibly
     // make this the default case of the keyword switch?
-    Value val;
-    val.type = ValueType::STRING;
-    std::memcpy(val.as.str, parser.previous.start + 1, parser.previous.length - 2);
-    val.as.str[parser.previous.length - 2] = '\0';
-    emitConstant(val);
+    emitConstant(
+        STRING_VAL(std::string_view(parser.previous.start + 1, parser.previous.length - 2)));
+    lastType = StaticType{};
   }
 
   void literal(bool tmp_) {
+    lastType = StaticType{};
     switch (parser.previous.type) {
     case TokenType::FALSE:
       emitByte(OpCode::FALSE);
@@ -783,31 +1037,50 @@ struct Compiler {
     if (end_line == ';') {
       parser.consume(TokenType::SEMICOLON, "Expect ';' after value.");
     }
+    if (current->scopeDepth == 0) resultPop = static_cast<int>(currentChunk()->code.size());
     emitByte(OpCode::POP);
   }
+  // Returns the offset of the jump's operand.
   int emitJump(uint8_t instruction) {
-    emitByte(instruction);
-    emitByte(0xff);
-    emitByte(0xff);
-    return currentChunk()->code.size() - 2;
+    const size_t index = jumpOffsets.size();
+    const bool wide = index < longJumps.size() && longJumps[index];
+    emitByte(wide ? wideOp(instruction) : instruction);
+    const int offset = static_cast<int>(currentChunk()->code.size());
+    jumpOffsets.push_back(offset);
+    for (int k = wide ? 4 : 2; k > 0; k--) emitByte(0xff);
+    return offset;
   }
   void patchJump(int offset) {
-    const auto count = currentChunk()->code.size();
-    int jump = count - offset - 2;
-    if (jump > UINT16_MAX) {
+    auto &code = currentChunk()->code;
+    const auto count = code.size();
+    const int bytes = instructionLength(code[offset - 1]) - 1;
+    const size_t jump = count - offset - bytes;
+    if (bytes == 2 && jump > UINT16_MAX) {
+      const auto index = std::lower_bound(jumpOffsets.begin(), jumpOffsets.end(), offset) -
+                         jumpOffsets.begin();
+      if (longJumps.size() <= static_cast<size_t>(index)) longJumps.resize(index + 1);
+      longJumps[index] = 1;
+      jumpsWidened = true;
+    } else if (jump > UINT32_MAX) {
       parser.error("Too much code to jump over.");
     }
-
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset + 1] = jump & 0xff;
+    for (int k = 0; k < bytes; k++) {
+      code[offset + k] = (jump >> (8 * (bytes - 1 - k))) & 0xff;
+    }
+    lastJumpTarget = static_cast<int>(count);
   }
   void emitLoop(int loopStart) {
-    emitByte(OpCode::LOOP);
-    int offset = currentChunk()->code.size() - loopStart + 2;
-    if (offset > UINT16_MAX) parser.error("Loop body too large.");
-
-    emitByte((offset >> 8) & 0xff);
-    emitByte(offset & 0xff);
+    const size_t narrow = currentChunk()->code.size() + 3 - loopStart;
+    if (narrow <= UINT16_MAX) {
+      emitByte(OpCode::LOOP);
+      emitByte((narrow >> 8) & 0xff);
+      emitByte(narrow & 0xff);
+      return;
+    }
+    const size_t offset = narrow + 2;
+    if (offset > UINT32_MAX) parser.error("Loop body too large.");
+    emitByte(OpCode::LOOP_LONG);
+    for (int shift = 24; shift >= 0; shift -= 8) emitByte((offset >> shift) & 0xff);
   }
   void ifStatement() {
     parser.consume(TokenType::LEFT_PAREN, "Expect  '(' after 'if'.");
@@ -884,7 +1157,16 @@ struct Compiler {
   }
 
   void endCompiler() {
+    // A script ending in an expression statement returns that expression's value.
+    // The POP stays if a jump lands after it (the statement ends an if or else
+    // branch): the other path reaches the end with nothing left to return.
+    auto chunk = currentChunk();
+    const int end = static_cast<int>(chunk->code.size());
+    if (resultPop >= 0 && resultPop == end - 1 && lastJumpTarget != end) {
+      chunk->truncate(end - 1);
+    }
     emitReturn();
+    chunk->maxDepth = chunk->computeMaxDepth();
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
       currentChunk()->disassemble("Code");
@@ -0,0 +1,1346 @@
+#ifndef PIPS_CONTEXT_HPP_
+#define PIPS_CONTEXT_HPP_
+//===========================================================================
+// Much of this code is based on the clox language from the book
+// "Crafting Interpreters" by Robert Nystrom
+// https://craftinginterpreters.com/contents.html which is available at
+// https://github.com/munificent/craftinginterpreters under the MIT License.
+// The code was adapted for C++ and simplified in many ways.
+//===========================================================================
+
+// #define DEBUG_TRACE_EXECUTION
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdarg.h>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.hpp"
+#include "globals.hpp"
+#include "math.hpp"
+#include "profile.hpp"
+#include "program.hpp"
+#include "register.hpp"
+#include "types.hpp"
+#include "value.hpp"
+
+namespace pips {
+
+template <typename Real = DefaultReal>
+using VTable = std::unordered_map<std::string, Value<Real>>;
+
+enum class InterpretResult { OK, COMPILE_ERROR, RUNTIME_ERROR };
+
+template <typename Real> struct VM;
+
+// Threaded dispatch through labels-as-values, a GCC and Clang extension. Define
+// PIPS_COMPUTED_GOTO to 0 to force the portable switch.
+#ifndef PIPS_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define PIPS_COMPUTED_GOTO 1
+#else
+#define PIPS_COMPUTED_GOTO 0
+#endif
+#endif
+
+// GCC's cross-jumping merges the identical dispatch sequences at the end of the
+// handlers back into one shared indirect jump, which undoes threaded dispatch.
+#if PIPS_COMPUTED_GOTO && defined(__GNUC__) && !defined(__clang__)
+#define PIPS_DISPATCH_ATTRIBUTES __attribute__((optimize("no-crossjumping")))
+#else
+#define PIPS_DISPATCH_ATTRIBUTES
+#endif
+
+// TODO: convert this to member function of VM
+#define BINARY_OP(valueType, op)                                                         \
+  do {                                                                                   \
+    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                                    \
+      runtimeError("Operands must be numbers.");                                         \
+      return InterpretResult::RUNTIME_ERROR;                                             \
+    }                                                                                    \
+    Real b = AS_NUMBER(pop());                                                    \
+    Real a = AS_NUMBER(pop());                                                    \
+    push(valueType(a op b));                                                             \
+  } while (false)
+
+#define MOD_OP(valueType)                                                                \
+  do {                                                                                   \
+    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                                    \
+                                                                                         \
+      runtimeError("Operands must be numbers.");                                         \
+      return InterpretResult::RUNTIME_ERROR;                                             \
+    }                                                                                    \
+    Real b = AS_NUMBER(pop());                                                    \
+    Real a = AS_NUMBER(pop());                                                    \
+    push(                                                                                \
+        valueType(static_cast<Real>(static_cast<int>(a) % static_cast<int>(b)))); \
+  } while (false)
+
+#define INTDIVIDE_OP(valueType)                                                          \
+  do {                                                                                   \
+    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                                    \
+                                                                                         \
+      runtimeError("Operands must be numbers.");                                         \
+      return InterpretResult::RUNTIME_ERROR;                                             \
+    }                                                                                    \
+    Real b = AS_NUMBER(pop());                                                    \
+    Real a = AS_NUMBER(pop());                                                    \
+    push(valueType(static_cast<Real>(static_cast<int>(a / b))));                  \
+  } while (false)
+
+#define STD_BINARY_OP(func,valueType)                                                              \
+  do {                                                                                   \
+    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                                    \
+      runtimeError("Operands must be numbers.");                                         \
+      return InterpretResult::RUNTIME_ERROR;                                             \
+    }                                                                                    \
+    Real b = AS_NUMBER(pop());                                                    \
+    Real a = AS_NUMBER(pop());                                                    \
+    push(valueType(func(a, b)));                                                     \
+  } while (false)
+
+#define BITWISE_OP(op)                                                                   \
+  do {                                                                                   \
+    if (!IS_INTEGRAL(peek(0)) || !IS_INTEGRAL(peek(1))) {                                \
+      runtimeError("Operands must be convertable to integers.");                         \
+      return InterpretResult::RUNTIME_ERROR;                                             \
+    }                                                                                   \
+    if (IS_BOOL(peek(0)) && IS_BOOL(peek(1))) {                                         \
+      bool b = AS_BOOL(pop());                                                        \
+      bool a = AS_BOOL(pop());                                                         \
+      push(BOOL_VAL(a op b));                                                          \
+    } else {                                                                            \
+      int64_t b = AS_INTEGER(pop());                                                     \
+      int64_t a = AS_INTEGER(pop());                                                     \
+      push(NUMBER_VAL(a op b));                                                         \
+    }                                                                                   \
+  } while (false)
+
+// Unchecked arithmetic on the two numbers on top of the stack.
+#define NUMBER_OP(expr)                                                                  \
+  do {                                                                                   \
+    const Real b = AS_NUMBER(pop());                                                     \
+    const Real a = AS_NUMBER(stackTop[-1]);                                              \
+    stackTop[-1] = NUMBER_VAL(expr);                                                     \
+  } while (false)
+
+// Operators of the register backend read R[b] (and R[c]) and write R[a] of the
+// current instruction `in`.
+#define REGISTER_UNARY_OP(expr)                                                          \
+  do {                                                                                   \
+    if (!IS_NUMBER(R[in->b])) {                                                          \
+      runtimeError("Operand must be a number");                                          \
+      return InterpretResult::RUNTIME_ERROR;                                             \
+    }                                                                                    \
+    const Real x = AS_NUMBER(R[in->b]);                                                  \
+    R[in->a] = NUMBER_VAL(expr);                                                         \
+  } while (false)
+
+#define REGISTER_BINARY_OP(valueType, expr)                                              \
+  do {                                                                                   \
+    if (!IS_NUMBER(R[in->b]) || !IS_NUMBER(R[in->c])) {                                  \
+      runtimeError("Operands must be numbers.");                                         \
+      return InterpretResult::RUNTIME_ERROR;                                             \
+    }                                                                                    \
+    const Real a = AS_NUMBER(R[in->b]);                                                  \
+    const Real b = AS_NUMBER(R[in->c]);                                                  \
+    R[in->a] = valueType(expr);                                                          \
+  } while (false)
+
+#define REGISTER_BITWISE_OP(op)                                                          \
+  do {                                                                                   \
+    if (!IS_INTEGRAL(R[in->c]) || !IS_INTEGRAL(R[in->b])) {                              \
+      runtimeError("Operands must be convertable to integers.");                         \
+      return InterpretResult::RUNTIME_ERROR;                                             \
+    }                                                                                    \
+    if (IS_BOOL(R[in->c]) && IS_BOOL(R[in->b])) {                                        \
+      bool b = AS_BOOL(R[in->c]);                                                        \
+      bool a = AS_BOOL(R[in->b]);                                                        \
+      R[in->a] = BOOL_VAL(a op b);                                                       \
+    } else {                                                                             \
+      int64_t b = AS_INTEGER(R[in->c]);                                                  \
+      int64_t a = AS_INTEGER(R[in->b]);                                                  \
+      R[in->a] = NUMBER_VAL(a op b);                                                     \
+    }                                                                                    \
+  } while (false)
+
+// Execution state for running compiled programs: the value stack, instruction
+// pointer, input frame and this context's global variable values.
+//
+// Concurrency contract:
+//  - A Program is immutable once VM::compile returns it and can be run by any
+//    number of contexts at the same time.
+//  - A Context is not thread safe. Use one per thread; it may run programs
+//    compiled by its VM at any time, including ones compiled after it was created.
+//  - VM::compile may be called from any thread while contexts are running.
+//  - Global values are private to a context. A context created from a VM starts
+//    with a copy of the globals the VM has defined, so create contexts while
+//    nothing is running on the VM itself.
+// A VM is itself a context, used by VM::run and VM::interpret.
+template <typename Real = DefaultReal>
+struct Context {
+  static_assert(std::is_floating_point_v<Real>, "Real must be a floating point type.");
+  using Value = pips::Value<Real>;
+  using Chunk = pips::Chunk<Real>;
+  using Program = pips::Program<Real>;
+  using VTable = pips::VTable<Real>;
+  using RegisterChunk = pips::RegisterChunk<Real>;
+
+  const Chunk *chunk;
+  const uint8_t *ip;
+  // The value stack. It is grown before a chunk runs to the chunk's maxDepth, up to
+  // stackLimit values, so the interpreter loop never checks for overflow.
+  Value *stack;
+  Value *stackTop;
+  std::vector<Value> stackValues;
+  size_t stackLimit;
+
+  // Register file and program counter of the register backend (see RegisterChunk).
+  // registerChunk is null while stack code runs.
+  const RegisterChunk *registerChunk;
+  const RegInstruction *pc;
+  std::vector<Value> registers;
+
+  // Global variables. The compiler resolves names to slots in globalNames, which is
+  // shared with the VM and its other contexts, and the values live in flat arrays
+  // indexed by slot.
+  std::shared_ptr<GlobalTable> globalNames;
+  std::vector<Value> globals;
+  std::vector<uint8_t> globalDefined;
+
+  // Host variables passed to run(), bound to the global slots they shadow for the
+  // duration of the run.
+  std::vector<Value> localValues;
+  std::vector<uint8_t> localBound;
+  std::vector<int> boundSlots;
+
+#ifdef PIPS_OPCODE_PROFILE
+  // Opcode pairs executed by run(), across all runs of this context.
+  OpcodeProfile opcodeProfile;
+#endif
+
+  // Value of the final expression statement of the last script run (nil if none).
+  Value returnValue;
+
+  // Pool of the strings left in globals and returnValue, shared with the VM.
+  std::shared_ptr<StringPool> stringPool;
+  // Strings concatenated by the current run. Those left in globals or returnValue
+  // are interned when the run ends and the rest are freed (see keepStrings).
+  TemporaryStrings strings;
+  // Whether the current run was given strings that stringPool does not hold.
+  bool foreignStrings = false;
+
+  // Input frame of the current run: element i is the value of the program's input i.
+  const Value *inputs;
+  std::vector<Value> inputFrame;
+  VTable noLocals;
+
+  // Inputs and stack slots of native code (see NativeCode).
+  std::vector<double> nativeInputs;
+  std::vector<double> nativeFrame;
+  std::vector<double> nativeGlobals;
+
+  Context(std::shared_ptr<GlobalTable> globalNames_, std::shared_ptr<StringPool> stringPool_,
+          size_t stackLimit_ = STACK_MAX)
+      : chunk(nullptr), ip(nullptr), stack(nullptr), stackTop(nullptr), stackLimit(stackLimit_),
+        registerChunk(nullptr), pc(nullptr), globalNames(std::move(globalNames_)),
+        stringPool(std::move(stringPool_)), inputs(nullptr) {}
+  // A context for running the programs of `vm`, usually on another thread. Its stack
+  // has the VM's limit unless given another.
+  explicit Context(const VM<Real> &vm) : Context(vm, vm.stackLimit) {}
+  Context(const VM<Real> &vm, size_t stackLimit_) : Context(vm.globalNames, vm.stringPool, stackLimit_) {
+    copyGlobals(vm);
+  }
+  ~Context() = default;
+  // The stack pointer and input frame point into the context itself.
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
+
+  void runtimeError(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    std::fputs("\n", stderr);
+
+    int line = (registerChunk != nullptr)
+                   ? registerChunk->lines.lineAt(pc - registerChunk->code.data() - 1)
+                   : chunk->lineAt(ip - chunk->code.data() - 1);
+    std::fprintf(stderr, "[line %d] in script\n", line);
+    stackTop = stack;
+  }
+
+  void push(Value val) {
+    *stackTop = val;
+    stackTop++;
+  }
+  Value pop() {
+    stackTop--;
+    return *stackTop;
+  }
+  const Value &peek(int dist) const { return stackTop[-1 - dist]; }
+  bool isFalsey(const Value &val) const { return IS_NIL(val) || (IS_BOOL(val) && !AS_BOOL(val)) || (IS_INTEGRAL(val) && AS_INTEGER(val) == 0); }
+  uint16_t readShort() {
+    ip += 2;
+    return static_cast<uint16_t>((ip[-2] << 8) | ip[-1]);
+  }
+  // 24-bit operand of CONSTANT_LONG and the wide local ops.
+  uint32_t readIndex() {
+    ip += 3;
+    return (static_cast<uint32_t>(ip[-3]) << 16) | (ip[-2] << 8) | ip[-1];
+  }
+  // 32-bit offset of the wide jumps.
+  uint32_t readOffset() {
+    ip += 4;
+    return (static_cast<uint32_t>(ip[-4]) << 24) | (ip[-3] << 16) | (ip[-2] << 8) | ip[-1];
+  }
+  void concatenate() {
+    const Value b = pop();
+    stackTop[-1] = pips::concatenate(stackTop[-1], b, strings);
+  }
+  void traceExecution() const {
+    printf("        ");
+    for (const Value *slot = stack; slot < stackTop; slot++) {
+      printf("[ ");
+      printValue(*slot);
+      printf(" ]");
+    }
+    printf("\n");
+    chunk->disassembleInstruction(static_cast<int>(ip - chunk->code.data()));
+  }
+
+  // The interpreter loop. With PIPS_COMPUTED_GOTO every handler ends by jumping
+  // straight to the handler of the next opcode through a table of label
+  // addresses, so each handler has its own indirect branch for the predictor to
+  // learn. Otherwise DISPATCH() breaks back to a single switch.
+  PIPS_DISPATCH_ATTRIBUTES InterpretResult run(VTable &locals) {
+    registerChunk = nullptr;
+#ifdef DEBUG_TRACE_EXECUTION
+#define PIPS_TRACE() traceExecution()
+#else
+#define PIPS_TRACE() ((void)0)
+#endif
+#ifdef PIPS_OPCODE_PROFILE
+#define PIPS_PROFILE() opcodeProfile.record(*ip)
+    opcodeProfile.start();
+#else
+#define PIPS_PROFILE() ((void)0)
+#endif
+#if PIPS_COMPUTED_GOTO
+#define PIPS_OPCODE_LABEL(name) &&op_##name,
+    static const void *const dispatchTable[] = {PIPS_OPCODES(PIPS_OPCODE_LABEL)};
+#undef PIPS_OPCODE_LABEL
+#define VM_CASE(name) op_##name
+#define DISPATCH()                                                                       \
+  do {                                                                                   \
+    PIPS_TRACE();                                                                        \
+    PIPS_PROFILE();                                                                      \
+    goto *dispatchTable[*ip++];                                                          \
+  } while (false)
+    DISPATCH();
+    {
+#else
+#define VM_CASE(name) case OpCode::name
+#define DISPATCH() break
+    for (;;) {
+      PIPS_TRACE();
+      PIPS_PROFILE();
+      switch (*ip++) {
+#endif
+      VM_CASE(NEGATE): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(-AS_NUMBER(pop())));
+        DISPATCH();
+      }
+      VM_CASE(UPLUS): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(AS_NUMBER(pop())));
+        DISPATCH();
+      }
+      VM_CASE(EXP): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::exp(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(SIN): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(pips::sin(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(COS): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(pips::cos(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(TAN): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(pips::tan(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(ABS): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::abs(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(LOG): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::log(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(LOG10): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::log10(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(SIGN): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL((AS_NUMBER(pop()) < Real(0) ? Real(-1) : Real(1))));
+        DISPATCH();
+      }
+      VM_CASE(SQRT): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::sqrt(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(ACOS): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::acos(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(ASIN): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::asin(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(ATAN): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::atan(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(ATAN2): {
+        STD_BINARY_OP(std::atan2, NUMBER_VAL);
+        DISPATCH();
+      }
+      VM_CASE(MIN): {
+        STD_BINARY_OP(std::min, NUMBER_VAL);
+        DISPATCH();
+      }
+      VM_CASE(MAX): {
+        STD_BINARY_OP(std::max, NUMBER_VAL);
+        DISPATCH();
+      }
+      VM_CASE(CEIL): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::ceil(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(FLOOR): {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(std::floor(AS_NUMBER(pop()))));
+        DISPATCH();
+      }
+      VM_CASE(ADD): {
+        if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+          concatenate();
+        } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+          Real b = AS_NUMBER(pop());
+          Real a = AS_NUMBER(pop());
+          push(NUMBER_VAL(a + b));
+        } else {
+          runtimeError("Operands must be two nuumbers or two strings!");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        DISPATCH();
+      }
+      VM_CASE(SUBTRACT): {
+        BINARY_OP(NUMBER_VAL, -);
+        DISPATCH();
+      }
+      VM_CASE(MULTIPLY): {
+        BINARY_OP(NUMBER_VAL, *);
+        DISPATCH();
+      }
+      VM_CASE(MOD): {
+        MOD_OP(NUMBER_VAL);
+        DISPATCH();
+      }
+      VM_CASE(DIVIDE): {
+        BINARY_OP(NUMBER_VAL, /);
+        DISPATCH();
+      }
+      VM_CASE(INTDIVIDE): {
+        INTDIVIDE_OP(NUMBER_VAL);
+        DISPATCH();
+      }
+      VM_CASE(POW): {
+        STD_BINARY_OP(std::pow, NUMBER_VAL);
+        DISPATCH();
+      }
+      VM_CASE(XOR): {
+        BITWISE_OP(^);
+        DISPATCH();
+      }
+      VM_CASE(BOR): {
+        BITWISE_OP(|);
+        DISPATCH();
+      }
+      VM_CASE(BAND): {
+        BITWISE_OP(&);
+        DISPATCH();
+      }
+      VM_CASE(BNOT): {
+        if (!IS_INTEGRAL(peek(0))) {
+          runtimeError("Operand must be an integer or boolean");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        if (IS_BOOL(peek(0))) {
+          push(BOOL_VAL(!AS_BOOL(pop())));
+        } else {
+          push(NUMBER_VAL(~AS_INTEGER(pop())));
+        }
+        DISPATCH();
+      }
+      VM_CASE(LSHIFT): {
+        BITWISE_OP(<<);
+        DISPATCH();
+      }
+      VM_CASE(RSHIFT): {
+        BITWISE_OP(>>);
+        DISPATCH();
+      }
+      VM_CASE(NOT): {
+        push(BOOL_VAL(isFalsey(pop())));
+        DISPATCH();
+      }
+      VM_CASE(RETURN): {
+        returnValue = (stackTop > stack) ? pop() : NIL_VAL;
+        return InterpretResult::OK;
+      }
+      VM_CASE(POP):
+        pop();
+        DISPATCH();
+      VM_CASE(DEFINE_GLOBAL): {
+        uint16_t slot = readShort();
+        globals[slot] = peek(0);
+        globalDefined[slot] = 1;
+        pop();
+        DISPATCH();
+      }
+      VM_CASE(SET_GLOBAL): {
+        uint16_t slot = readShort();
+        // for implicit declaration drop the check
+        // This disallows implict declaration (must have var)
+        if (!globalDefined[slot]) {
+          runtimeError("Undefined variable '%s'.", globalNames->name(slot).c_str());
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        globals[slot] = peek(0);
+        DISPATCH();
+      }
+      VM_CASE(GET_GLOBAL): {
+        uint16_t slot = readShort();
+        if (localBound[slot]) {
+          push(localValues[slot]);
+        } else if (globalDefined[slot]) {
+          push(globals[slot]);
+        } else {
+          runtimeError("Undefined variable '%s'.", globalNames->name(slot).c_str());
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        DISPATCH();
+      }
+      VM_CASE(GET_LOCAL): {
+        uint8_t slot = *ip++;
+        push(stack[slot]);
+        DISPATCH();
+      }
+      VM_CASE(GET_INPUT): {
+        uint8_t slot = *ip++;
+        push(inputs[slot]);
+        DISPATCH();
+      }
+      VM_CASE(SET_LOCAL): {
+        uint8_t slot = *ip++;
+        stack[slot] = peek(0);
+        DISPATCH();
+      }
+      VM_CASE(CONSTANT): {
+        Value constant = chunk->constants[(*ip++)];
+        push(constant);
+        DISPATCH();
+      }
+      VM_CASE(NIL): {
+        push(NIL_VAL);
+        DISPATCH();
+      }
+      VM_CASE(TRUE): {
+        push(BOOL_VAL(true));
+        DISPATCH();
+      }
+      VM_CASE(FALSE): {
+        push(BOOL_VAL(false));
+        DISPATCH();
+      }
+      VM_CASE(EQUAL): {
+        Value b = pop();
+        Value a = pop();
+        push(BOOL_VAL(valuesEqual(a, b)));
+        DISPATCH();
+      }
+      VM_CASE(GREATER):
+        BINARY_OP(BOOL_VAL, >);
+        DISPATCH();
+      VM_CASE(LESS):
+        BINARY_OP(BOOL_VAL, <);
+        DISPATCH();
+      VM_CASE(NOT_EQUAL): {
+        Value b = pop();
+        Value a = pop();
+        push(BOOL_VAL(!valuesEqual(a, b)));
+        DISPATCH();
+      }
+      // The fused comparisons negate the opposite comparison, as the LESS NOT and
+      // GREATER NOT pairs they replace do, so comparisons with NaN are true.
+      VM_CASE(GREATER_EQUAL): {
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+          runtimeError("Operands must be numbers.");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        Real b = AS_NUMBER(pop());
+        Real a = AS_NUMBER(pop());
+        push(BOOL_VAL(!(a < b)));
+        DISPATCH();
+      }
+      VM_CASE(LESS_EQUAL): {
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+          runtimeError("Operands must be numbers.");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        Real b = AS_NUMBER(pop());
+        Real a = AS_NUMBER(pop());
+        push(BOOL_VAL(!(a > b)));
+        DISPATCH();
+      }
+      VM_CASE(PRINT): {
+        printValue(pop());
+        printf(" ");
+        DISPATCH();
+      }
+      VM_CASE(LIST): {
+        for(const auto &v: locals) {
+          printf("%s = ", v.first.c_str());
+          printValue(v.second);
+          printf("\n");
+        }
+        for (size_t slot = 0; slot < globals.size(); slot++) {
+          if (!globalDefined[slot]) continue;
+          printf("%s = ", globalNames->name(slot).c_str());
+          printValue(globals[slot]);
+          printf("\n");
+        }
+        // print stack values
+        for(Value *slot = stack; slot < stackTop; slot++) {
+          printf("stack[%ld] = ", slot - stack);
+          printValue(*slot);
+          printf("\n");
+        }
+        DISPATCH();
+      }
+      VM_CASE(NEWLINE): {
+        printf("\n");
+        DISPATCH();
+      }
+      VM_CASE(JUMP_IF_FALSE): {
+        uint16_t offset = readShort();
+        if (isFalsey(peek(0))) ip += offset;
+        DISPATCH();
+      }
+      VM_CASE(JUMP): {
+        uint16_t offset = readShort();
+        ip += offset;
+        DISPATCH();
+      }
+      VM_CASE(LOOP): {
+        uint16_t offset = readShort();
+        ip -= offset;
+        DISPATCH();
+      }
+      // Wide operands, for chunks with many constants or locals or long jumps.
+      VM_CASE(CONSTANT_LONG): {
+        push(chunk->constants[readIndex()]);
+        DISPATCH();
+      }
+      VM_CASE(GET_LOCAL_LONG): {
+        push(stack[readIndex()]);
+        DISPATCH();
+      }
+      VM_CASE(SET_LOCAL_LONG): {
+        stack[readIndex()] = peek(0);
+        DISPATCH();
+      }
+      VM_CASE(JUMP_IF_FALSE_LONG): {
+        uint32_t offset = readOffset();
+        if (isFalsey(peek(0))) ip += offset;
+        DISPATCH();
+      }
+      VM_CASE(JUMP_LONG): {
+        uint32_t offset = readOffset();
+        ip += offset;
+        DISPATCH();
+      }
+      VM_CASE(LOOP_LONG): {
+        uint32_t offset = readOffset();
+        ip -= offset;
+        DISPATCH();
+      }
+      VM_CASE(ADD_NUM): {
+        NUMBER_OP(a + b);
+        DISPATCH();
+      }
+      VM_CASE(SUBTRACT_NUM): {
+        NUMBER_OP(a - b);
+        DISPATCH();
+      }
+      VM_CASE(MULTIPLY_NUM): {
+        NUMBER_OP(a * b);
+        DISPATCH();
+      }
+      VM_CASE(DIVIDE_NUM): {
+        NUMBER_OP(a / b);
+        DISPATCH();
+      }
+      VM_CASE(MOD_NUM): {
+        NUMBER_OP(static_cast<Real>(static_cast<int>(a) % static_cast<int>(b)));
+        DISPATCH();
+      }
+      VM_CASE(POW_NUM): {
+        NUMBER_OP(std::pow(a, b));
+        DISPATCH();
+      }
+      VM_CASE(NEGATE_NUM): {
+        stackTop[-1] = NUMBER_VAL(-AS_NUMBER(stackTop[-1]));
+        DISPATCH();
+      }
+      // Superinstructions produced by PeepholeOptimizer.
+      VM_CASE(ADD_LOCAL_CONST): {
+        const Value &a = stack[ip[0]];
+        const Value &b = chunk->constants[ip[1]];
+        ip += 2;
+        if (IS_NUMBER(a) && IS_NUMBER(b)) {
+          push(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+        } else if (IS_STRING(a) && IS_STRING(b)) {
+          push(pips::concatenate(a, b, strings));
+        } else {
+          runtimeError("Operands must be two nuumbers or two strings!");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        DISPATCH();
+      }
+      VM_CASE(MULTIPLY_LOCALS): {
+        const Value &a = stack[ip[0]];
+        const Value &b = stack[ip[1]];
+        ip += 2;
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+          runtimeError("Operands must be numbers.");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b)));
+        DISPATCH();
+      }
+      VM_CASE(SET_LOCAL_CONST): {
+        const Value &constant = chunk->constants[ip[1]];
+        stack[ip[0]] = constant;
+        push(constant);
+        ip += 2;
+        DISPATCH();
+      }
+      VM_CASE(LESS_JUMP_IF_FALSE): {
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+          runtimeError("Operands must be numbers.");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        Real b = AS_NUMBER(pop());
+        Real a = AS_NUMBER(pop());
+        push(BOOL_VAL(a < b));
+        uint16_t offset = readShort();
+        if (!(a < b)) ip += offset;
+        DISPATCH();
+      }
+#if !PIPS_COMPUTED_GOTO
+      }
+#endif
+    }
+#undef VM_CASE
+#undef DISPATCH
+#undef PIPS_TRACE
+#undef PIPS_PROFILE
+    return InterpretResult::RUNTIME_ERROR;
+  }
+
+  // The interpreter loop of the register backend, dispatched like run(VTable &).
+  // Inputs and constants are copied into the register file first; every other
+  // operand is read and written in place.
+  PIPS_DISPATCH_ATTRIBUTES InterpretResult runRegisters(const RegisterChunk &code,
+                                                        VTable &locals) {
+    registerChunk = &code;
+    // Inputs and constants sit below stackBase; the registers above it stand for the
+    // stack and count against the limit like the stack VM's values do.
+    if (!withinStackLimit(code.registerCount - code.stackBase)) {
+      return InterpretResult::RUNTIME_ERROR;
+    }
+    if (registers.size() < code.registerCount) registers.resize(code.registerCount);
+    Value *R = registers.data();
+    std::copy(inputs, inputs + code.inputCount, R);
+    std::copy(code.constants.begin(), code.constants.end(), R + code.inputCount);
+    pc = code.code.data();
+    const RegInstruction *in = pc;
+#ifdef DEBUG_TRACE_EXECUTION
+#define PIPS_TRACE() code.disassembleInstruction(static_cast<int>(pc - code.code.data()))
+#else
+#define PIPS_TRACE() ((void)0)
+#endif
+#if PIPS_COMPUTED_GOTO
+#define PIPS_OPCODE_LABEL(name) &&reg_##name,
+    static const void *const dispatchTable[] = {PIPS_REGISTER_OPCODES(PIPS_OPCODE_LABEL)};
+#undef PIPS_OPCODE_LABEL
+#define VM_CASE(name) reg_##name
+#define DISPATCH()                                                                       \
+  do {                                                                                   \
+    PIPS_TRACE();                                                                        \
+    in = pc++;                                                                           \
+    goto *dispatchTable[static_cast<uint8_t>(in->op)];                                   \
+  } while (false)
+    DISPATCH();
+    {
+#else
+#define VM_CASE(name) case RegOp::name
+#define DISPATCH() break
+    for (;;) {
+      PIPS_TRACE();
+      in = pc++;
+      switch (in->op) {
+#endif
+      VM_CASE(MOVE): {
+        R[in->a] = R[in->b];
+        DISPATCH();
+      }
+      VM_CASE(NEGATE): {
+        REGISTER_UNARY_OP(-x);
+        DISPATCH();
+      }
+      VM_CASE(UPLUS): {
+        REGISTER_UNARY_OP(x);
+        DISPATCH();
+      }
+      VM_CASE(EXP): {
+        REGISTER_UNARY_OP(std::exp(x));
+        DISPATCH();
+      }
+      VM_CASE(SIN): {
+        REGISTER_UNARY_OP(pips::sin(x));
+        DISPATCH();
+      }
+      VM_CASE(COS): {
+        REGISTER_UNARY_OP(pips::cos(x));
+        DISPATCH();
+      }
+      VM_CASE(TAN): {
+        REGISTER_UNARY_OP(pips::tan(x));
+        DISPATCH();
+      }
+      VM_CASE(ABS): {
+        REGISTER_UNARY_OP(std::abs(x));
+        DISPATCH();
+      }
+      VM_CASE(LOG): {
+        REGISTER_UNARY_OP(std::log(x));
+        DISPATCH();
+      }
+      VM_CASE(LOG10): {
+        REGISTER_UNARY_OP(std::log10(x));
+        DISPATCH();
+      }
+      VM_CASE(SIGN): {
+        REGISTER_UNARY_OP((x < Real(0) ? Real(-1) : Real(1)));
+        DISPATCH();
+      }
+      VM_CASE(SQRT): {
+        REGISTER_UNARY_OP(std::sqrt(x));
+        DISPATCH();
+      }
+      VM_CASE(ACOS): {
+        REGISTER_UNARY_OP(std::acos(x));
+        DISPATCH();
+      }
+      VM_CASE(ASIN): {
+        REGISTER_UNARY_OP(std::asin(x));
+        DISPATCH();
+      }
+      VM_CASE(ATAN): {
+        REGISTER_UNARY_OP(std::atan(x));
+        DISPATCH();
+      }
+      VM_CASE(CEIL): {
+        REGISTER_UNARY_OP(std::ceil(x));
+        DISPATCH();
+      }
+      VM_CASE(FLOOR): {
+        REGISTER_UNARY_OP(std::floor(x));
+        DISPATCH();
+      }
+      VM_CASE(NOT): {
+        R[in->a] = BOOL_VAL(isFalsey(R[in->b]));
+        DISPATCH();
+      }
+      VM_CASE(BNOT): {
+        if (!IS_INTEGRAL(R[in->b])) {
+          runtimeError("Operand must be an integer or boolean");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        if (IS_BOOL(R[in->b])) {
+          R[in->a] = BOOL_VAL(!AS_BOOL(R[in->b]));
+        } else {
+          R[in->a] = NUMBER_VAL(~AS_INTEGER(R[in->b]));
+        }
+        DISPATCH();
+      }
+      VM_CASE(ADD): {
+        if (IS_STRING(R[in->c]) && IS_STRING(R[in->b])) {
+          R[in->a] = pips::concatenate(R[in->b], R[in->c], strings);
+        } else if (IS_NUMBER(R[in->c]) && IS_NUMBER(R[in->b])) {
+          R[in->a] = NUMBER_VAL(AS_NUMBER(R[in->b]) + AS_NUMBER(R[in->c]));
+        } else {
+          runtimeError("Operands must be two nuumbers or two strings!");
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        DISPATCH();
+      }
+      VM_CASE(SUBTRACT): {
+        REGISTER_BINARY_OP(NUMBER_VAL, a - b);
+        DISPATCH();
+      }
+      VM_CASE(MULTIPLY): {
+        REGISTER_BINARY_OP(NUMBER_VAL, a * b);
+        DISPATCH();
+      }
+      VM_CASE(DIVIDE): {
+        REGISTER_BINARY_OP(NUMBER_VAL, a / b);
+        DISPATCH();
+      }
+      VM_CASE(INTDIVIDE): {
+        REGISTER_BINARY_OP(NUMBER_VAL, static_cast<Real>(static_cast<int>(a / b)));
+        DISPATCH();
+      }
+      VM_CASE(MOD): {
+        REGISTER_BINARY_OP(NUMBER_VAL,
+                           static_cast<Real>(static_cast<int>(a) % static_cast<int>(b)));
+        DISPATCH();
+      }
+      VM_CASE(POW): {
+        REGISTER_BINARY_OP(NUMBER_VAL, std::pow(a, b));
+        DISPATCH();
+      }
+      VM_CASE(ATAN2): {
+        REGISTER_BINARY_OP(NUMBER_VAL, std::atan2(a, b));
+        DISPATCH();
+      }
+      VM_CASE(MIN): {
+        REGISTER_BINARY_OP(NUMBER_VAL, std::min(a, b));
+        DISPATCH();
+      }
+      VM_CASE(MAX): {
+        REGISTER_BINARY_OP(NUMBER_VAL, std::max(a, b));
+        DISPATCH();
+      }
+      VM_CASE(GREATER): {
+        REGISTER_BINARY_OP(BOOL_VAL, a > b);
+        DISPATCH();
+      }
+      VM_CASE(LESS): {
+        REGISTER_BINARY_OP(BOOL_VAL, a < b);
+        DISPATCH();
+      }
+      VM_CASE(XOR): {
+        REGISTER_BITWISE_OP(^);
+        DISPATCH();
+      }
+      VM_CASE(BOR): {
+        REGISTER_BITWISE_OP(|);
+        DISPATCH();
+      }
+      VM_CASE(BAND): {
+        REGISTER_BITWISE_OP(&);
+        DISPATCH();
+      }
+      VM_CASE(LSHIFT): {
+        REGISTER_BITWISE_OP(<<);
+        DISPATCH();
+      }
+      VM_CASE(RSHIFT): {
+        REGISTER_BITWISE_OP(>>);
+        DISPATCH();
+      }
+      VM_CASE(EQUAL): {
+        R[in->a] = BOOL_VAL(valuesEqual(R[in->b], R[in->c]));
+        DISPATCH();
+      }
+      VM_CASE(NOT_EQUAL): {
+        R[in->a] = BOOL_VAL(!valuesEqual(R[in->b], R[in->c]));
+        DISPATCH();
+      }
+      VM_CASE(GREATER_EQUAL): {
+        REGISTER_BINARY_OP(BOOL_VAL, !(a < b));
+        DISPATCH();
+      }
+      VM_CASE(LESS_EQUAL): {
+        REGISTER_BINARY_OP(BOOL_VAL, !(a > b));
+        DISPATCH();
+      }
+      VM_CASE(DEFINE_GLOBAL): {
+        globals[in->a] = R[in->b];
+        globalDefined[in->a] = 1;
+        DISPATCH();
+      }
+      VM_CASE(SET_GLOBAL): {
+        if (!globalDefined[in->a]) {
+          runtimeError("Undefined variable '%s'.", globalNames->name(in->a).c_str());
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        globals[in->a] = R[in->b];
+        DISPATCH();
+      }
+      VM_CASE(GET_GLOBAL): {
+        const uint16_t slot = in->b;
+        if (localBound[slot]) {
+          R[in->a] = localValues[slot];
+        } else if (globalDefined[slot]) {
+          R[in->a] = globals[slot];
+        } else {
+          runtimeError("Undefined variable '%s'.", globalNames->name(slot).c_str());
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        DISPATCH();
+      }
+      VM_CASE(PRINT): {
+        printValue(R[in->b]);
+        printf(" ");
+        DISPATCH();
+      }
+      VM_CASE(NEWLINE): {
+        printf("\n");
+        DISPATCH();
+      }
+      VM_CASE(LIST): {
+        for (const auto &v : locals) {
+          printf("%s = ", v.first.c_str());
+          printValue(v.second);
+          printf("\n");
+        }
+        for (size_t slot = 0; slot < globals.size(); slot++) {
+          if (!globalDefined[slot]) continue;
+          printf("%s = ", globalNames->name(slot).c_str());
+          printValue(globals[slot]);
+          printf("\n");
+        }
+        for (int slot = 0; slot < in->a; slot++) {
+          printf("stack[%d] = ", slot);
+          printValue(R[code.stackBase + slot]);
+          printf("\n");
+        }
+        DISPATCH();
+      }
+      VM_CASE(JUMP): {
+        pc = code.code.data() + in->a;
+        DISPATCH();
+      }
+      VM_CASE(JUMP_IF_FALSE): {
+        if (isFalsey(R[in->b])) pc = code.code.data() + in->a;
+        DISPATCH();
+      }
+      VM_CASE(RETURN): {
+        returnValue = R[in->b];
+        return InterpretResult::OK;
+      }
+#if !PIPS_COMPUTED_GOTO
+      }
+#endif
+    }
+#undef VM_CASE
+#undef DISPATCH
+#undef PIPS_TRACE
+    return InterpretResult::RUNTIME_ERROR;
+  }
+
+  // Run a program on the backend it was compiled for, once inputs and globals are set.
+  InterpretResult execute(const Program &program, VTable &locals) {
+    const InterpretResult status = executeBackend(program, locals);
+    // Strings of another pool, such as constants of a program compiled by another
+    // VM, must not outlive the run unless this context's pool holds them.
+    if (!strings.empty() || foreignStrings || program.strings != stringPool) keepStrings();
+    foreignStrings = false;
+    return status;
+  }
+  InterpretResult executeBackend(const Program &program, VTable &locals) {
+    if (program.backend == Backend::REGISTER) {
+      return runRegisters(program.registerCode, locals);
+    }
+    if (program.backend == Backend::NATIVE && program.native != nullptr) {
+      // Native code takes numbers only; other inputs run on the stack VM.
+      const size_t count = program.inputs.size();
+      nativeInputs.resize(count);
+      size_t i = 0;
+      for (; i < count && IS_NUMBER(inputs[i]); i++) {
+        nativeInputs[i] = static_cast<double>(AS_NUMBER(inputs[i]));
+      }
+      if (i == count && nativeGlobalsReady(*program.native)) {
+        return runNative(*program.native, nativeInputs.data());
+      }
+    }
+    chunk = &program.chunk;
+    ip = chunk->code.data();
+    if (!withinStackLimit(chunk->maxDepth) || !reserveStack(chunk->maxDepth)) {
+      return InterpretResult::RUNTIME_ERROR;
+    }
+    stackTop = stack;
+    return run(locals);
+  }
+  // Intern the strings that outlive the run into stringPool and free the temporary
+  // ones. Only
+  // globals and returnValue are read after a run; the stack, the registers and the
+  // inputs are not.
+  void keepStrings() {
+    for (Value &global : globals) global = keepValue(global, *stringPool);
+    returnValue = keepValue(returnValue, *stringPool);
+    strings.reset();
+  }
+  // Reports a stack overflow and returns false if a run needs more than stackLimit
+  // values, on whichever backend holds them.
+  bool withinStackLimit(int depth) const {
+    if (static_cast<size_t>(depth) <= stackLimit) return true;
+    std::fprintf(stderr, "Stack overflow: the program needs %d values, the limit is %zu.\n",
+                 depth, stackLimit);
+    return false;
+  }
+  // Make room for `depth` values on the stack. Returns false if that exceeds the limit.
+  bool reserveStack(int depth) {
+    const size_t needed = static_cast<size_t>(depth);
+    if (needed <= stackValues.size()) return true;
+    if (needed > stackLimit) return false;
+    stackValues.resize(needed);
+    stack = stackValues.data();
+    return true;
+  }
+
+  // Whether native code can run on the current globals: the ones it reads before
+  // defining them must hold numbers, and none may be shadowed by a bound local.
+  // Otherwise the stack VM runs the program (and reports undefined variables).
+  bool nativeGlobalsReady(const NativeCode &native) {
+    reserveGlobals();
+    for (size_t g = 0; g < native.globalSlots.size(); g++) {
+      const uint16_t slot = native.globalSlots[g];
+      if (localBound[slot]) return false;
+      if (native.entryGlobals[g] && (!globalDefined[slot] || !IS_NUMBER(globals[slot]))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  InterpretResult runNative(const NativeCode &native, const double *inputs_) {
+    if (!withinStackLimit(native.maxDepth)) return InterpretResult::RUNTIME_ERROR;
+    if (nativeFrame.size() < static_cast<size_t>(native.maxDepth)) {
+      nativeFrame.resize(native.maxDepth);
+    }
+    const size_t globalCount = native.globalSlots.size();
+    if (nativeGlobals.size() < globalCount) nativeGlobals.resize(globalCount);
+    for (size_t g = 0; g < globalCount; g++) {
+      if (native.entryGlobals[g]) {
+        nativeGlobals[g] = static_cast<double>(AS_NUMBER(globals[native.globalSlots[g]]));
+      }
+    }
+    const double result = native.function(inputs_, nativeFrame.data(), nativeGlobals.data());
+    for (size_t g = 0; g < globalCount; g++) {
+      if (!native.entryGlobals[g] && !native.exitGlobals[g]) continue;
+      const uint16_t slot = native.globalSlots[g];
+      globals[slot] = NUMBER_VAL(static_cast<Real>(nativeGlobals[g]));
+      globalDefined[slot] = 1;
+    }
+    switch (native.result) {
+    case NumericType::NUMBER:
+      returnValue = NUMBER_VAL(static_cast<Real>(result));
+      break;
+    case NumericType::BOOL:
+      returnValue = BOOL_VAL(result != 0.0);
+      break;
+    default:
+      returnValue = NIL_VAL;
+    }
+    return InterpretResult::OK;
+  }
+
+  // Execute a previously compiled program. No scanning or parsing takes place.
+  InterpretResult run(const Program &program) {
+    VTable locals;
+    return run(program, locals);
+  }
+  InterpretResult run(const Program &program, VTable &locals) {
+    if (!program.inputs.empty()) {
+      // Fill the input frame by name; prefer the Value*/Real* overloads in hot loops.
+      inputFrame.resize(program.inputs.size());
+      for (size_t i = 0; i < program.inputs.size(); i++) {
+        auto found = locals.find(program.inputs[i]);
+        if (found == locals.end()) {
+          std::fprintf(stderr, "Missing value for input '%s'.\n", program.inputs[i].c_str());
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        inputFrame[i] = found->second;
+      }
+    }
+    inputs = inputFrame.data();
+    foreignStrings = holdsForeignStrings(inputs, program.inputs.size());
+    reserveGlobals();
+    bindLocals(locals);
+    auto status = execute(program, locals);
+    unbindLocals();
+    return status;
+  }
+  // Execute with a pre-bound input frame: inputs_[i] is the value of the input
+  // declared at index i (see Program::inputSlot). Nothing is hashed or allocated.
+  InterpretResult run(const Program &program, const Value *inputs_) {
+    inputs = inputs_;
+    foreignStrings = holdsForeignStrings(inputs, program.inputs.size());
+    reserveGlobals();
+    return execute(program, noLocals);
+  }
+  InterpretResult run(const Program &program, const Real *inputs_) {
+    if constexpr (std::is_same_v<Real, double>) {
+      if (program.backend == Backend::NATIVE && program.native != nullptr &&
+          nativeGlobalsReady(*program.native)) {
+        return runNative(*program.native, inputs_);
+      }
+    }
+    const size_t count = program.inputs.size();
+    if (inputFrame.size() < count) inputFrame.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      inputFrame[i] = NUMBER_VAL(inputs_[i]);
+    }
+    return run(program, static_cast<const Value *>(inputFrame.data()));
+  }
+
+  // Replace this context's global values with those of `other` (e.g. its VM).
+  void copyGlobals(const Context &other) {
+    globals = other.globals;
+    globalDefined = other.globalDefined;
+    localValues.resize(globals.size());
+    localBound.assign(globals.size(), 0);
+    boundSlots.clear();
+  }
+
+  // Grow the slot arrays to cover every global the compiler has resolved so far.
+  void reserveGlobals() {
+    const size_t count = globalNames->size();
+    if (globals.size() >= count) return;
+    globals.resize(count);
+    globalDefined.resize(count, 0);
+    localValues.resize(count);
+    localBound.resize(count, 0);
+  }
+  void bindLocals(const VTable &locals) {
+    for (const auto &[name, value] : locals) {
+      const int slot = globalNames->find(name);
+      if (slot < 0) continue; // not referenced by any compiled code
+      localValues[slot] = value;
+      localBound[slot] = 1;
+      foreignStrings = foreignStrings || holdsForeignStrings(&value, 1);
+      boundSlots.push_back(slot);
+    }
+  }
+  // Whether any of `count` values is a string stringPool does not hold.
+  bool holdsForeignStrings(const Value *values, size_t count) const {
+    for (size_t i = 0; i < count; i++) {
+      if (IS_STRING(values[i]) && !stringPool->holds(AS_STRING(values[i]))) return true;
+    }
+    return false;
+  }
+  void unbindLocals() {
+    for (int slot : boundSlots) {
+      localBound[slot] = 0;
+    }
+    boundSlots.clear();
+  }
+
+  // Value of a defined global variable, or nullptr.
+  const Value *getGlobal(const std::string &name) const {
+    return getGlobal(globalNames->find(name));
+  }
+  // Slot of a global for repeated reads with getGlobal(int), or -1.
+  int globalSlot(const std::string &name) const { return globalNames->find(name); }
+  const Value *getGlobal(int slot) const {
+    if (slot < 0 || slot >= static_cast<int>(globals.size()) || !globalDefined[slot]) {
+      return nullptr;
+    }
+    return &globals[slot];
+  }
+  // Define (or overwrite) a global variable from the host.
+  void setGlobal(const std::string &name, Value val) {
+    const int slot = globalNames->resolve(name);
+    if (slot < 0) return;
+    reserveGlobals();
+    globals[slot] = keepValue(val, *stringPool);
+    globalDefined[slot] = 1;
+  }
+};
+
+} // namespace pips
+#endif // PIPS_CONTEXT_HPP_
@@ -0,0 +1,61 @@
+#ifndef PIPS_GLOBALS_HPP_
+#define PIPS_GLOBALS_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace pips {
+
+// Names of global variables. The compiler interns each name to a dense slot index
+// once, and the VM stores the values in a flat array indexed by that slot, so no
+// string is built or hashed when a global is read or written at runtime.
+//
+// The table is shared by a VM and all of its contexts and may be used from any
+// thread. size() is a lock-free read so contexts can size their slot arrays on
+// every run; the other members take the table's lock.
+struct GlobalTable {
+  static constexpr size_t MAX_GLOBALS = UINT16_MAX + 1;
+
+  mutable std::mutex mutex;
+  std::vector<std::string> names;
+  std::unordered_map<std::string, int> slots;
+  std::atomic<size_t> count{0};
+
+  GlobalTable() = default;
+  ~GlobalTable() = default;
+  GlobalTable(const GlobalTable &) = delete;
+  GlobalTable &operator=(const GlobalTable &) = delete;
+
+  // Slot of `name`, or -1 if it has never been seen.
+  int find(const std::string &name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = slots.find(name);
+    return (found == slots.end()) ? -1 : found->second;
+  }
+  // Slot of `name`, adding it if needed. Returns -1 once the table is full.
+  int resolve(std::string_view name) {
+    std::string key(name);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = slots.find(key);
+    if (found != slots.end()) return found->second;
+    if (names.size() == MAX_GLOBALS) return -1;
+    const int slot = static_cast<int>(names.size());
+    names.push_back(key);
+    slots.emplace(std::move(key), slot);
+    count.store(names.size(), std::memory_order_release);
+    return slot;
+  }
+  size_t size() const { return count.load(std::memory_order_acquire); }
+  std::string name(int slot) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return names[slot];
+  }
+};
+
+} // namespace pips
+#endif // PIPS_GLOBALS_HPP_
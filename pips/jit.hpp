@@ -0,0 +1,529 @@
+#ifndef PIPS_JIT_HPP_
+#define PIPS_JIT_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "chunk.hpp"
+#include "math.hpp"
+#include "numeric.hpp"
+#include "value.hpp"
+
+// The JIT emits x86-64 System V code into mmap'd memory. Elsewhere, or unless the
+// build defines PIPS_JIT (CMake option PIPS_JIT), JitCompiler compiles nothing and
+// native programs run on the stack VM.
+#if defined(PIPS_JIT) && defined(__x86_64__) && defined(__linux__)
+#define PIPS_JIT_AVAILABLE 1
+#include <sys/mman.h>
+#else
+#define PIPS_JIT_AVAILABLE 0
+#endif
+
+namespace pips {
+
+// Machine code for one chunk. It is called with the numeric input frame, a frame of
+// maxDepth doubles for the stack slots and one double per entry of globalSlots, and
+// returns the script's result (booleans as 0 or 1, nil as 0). The caller fills in
+// the globals marked in entryGlobals before the call, and copies those and the ones
+// marked in exitGlobals back to the VM afterwards.
+struct NativeCode {
+  using Function = double (*)(const double *inputs, double *frame, double *globals);
+
+  void *memory = nullptr;
+  size_t size = 0;
+  Function function = nullptr;
+  NumericType result = NumericType::NIL;
+  int maxDepth = 0;
+  std::vector<uint16_t> globalSlots;
+  std::vector<uint8_t> entryGlobals;
+  std::vector<uint8_t> exitGlobals;
+
+  NativeCode() = default;
+  ~NativeCode() {
+#if PIPS_JIT_AVAILABLE
+    if (memory != nullptr) munmap(memory, size);
+#endif
+  }
+  NativeCode(const NativeCode &) = delete;
+  NativeCode &operator=(const NativeCode &) = delete;
+};
+
+// Baseline compiler from stack bytecode to native code, in one pass over the chunk
+// with a fixed instruction sequence per opcode. The stack lives in a frame of doubles;
+// the dispatch loop and the type checks disappear, and operands are read from where
+// they are instead of being copied onto the stack first (see Operand).
+//
+// Only numeric chunks are compiled (see NumericAnalysis); programs with any other
+// chunk keep running on the stack VM, and so do runs where a global the code reads
+// does not hold a number.
+template <typename Real = DefaultReal>
+struct JitCompiler {
+  using Chunk = pips::Chunk<Real>;
+  using Analysis = NumericAnalysis<Real>;
+
+  const Chunk *chunk = nullptr;
+  Analysis analysis;
+
+  std::vector<uint8_t> code;
+  // Native offset of each bytecode instruction, and rel32 fields to patch with the
+  // native offset of a bytecode target.
+  std::vector<int> labels;
+  std::vector<std::pair<size_t, size_t>> fixups;
+
+  JitCompiler() = default;
+  ~JitCompiler() = default;
+
+  // Encoding. Values are computed in xmm0 and xmm1; rbx holds the input frame, r12
+  // the slot frame and r13 the globals, all callee-saved so that helper calls keep
+  // them.
+  void byte(uint8_t b) { code.push_back(b); }
+  void bytes(std::initializer_list<uint8_t> list) { code.insert(code.end(), list); }
+  void int32(int32_t value) {
+    for (int k = 0; k < 4; k++) byte(static_cast<uint8_t>((value >> (8 * k)) & 0xff));
+  }
+  void int64(uint64_t value) {
+    for (int k = 0; k < 8; k++) byte(static_cast<uint8_t>((value >> (8 * k)) & 0xff));
+  }
+  void load(int xmm, int slot) { // movsd xmm, [r12 + 8 * slot]
+    bytes({0xF2, 0x41, 0x0F, 0x10, static_cast<uint8_t>(0x84 | (xmm << 3)), 0x24});
+    int32(8 * slot);
+  }
+  void store(int xmm, int slot) { // movsd [r12 + 8 * slot], xmm
+    bytes({0xF2, 0x41, 0x0F, 0x11, static_cast<uint8_t>(0x84 | (xmm << 3)), 0x24});
+    int32(8 * slot);
+  }
+  void loadGlobal(int xmm, int global) { // movsd xmm, [r13 + 8 * global]
+    bytes({0xF2, 0x41, 0x0F, 0x10, static_cast<uint8_t>(0x85 | (xmm << 3))});
+    int32(8 * global);
+  }
+  void storeGlobal(int xmm, int global) { // movsd [r13 + 8 * global], xmm
+    bytes({0xF2, 0x41, 0x0F, 0x11, static_cast<uint8_t>(0x85 | (xmm << 3))});
+    int32(8 * global);
+  }
+  void loadInput(int xmm, int input) { // movsd xmm, [rbx + 8 * input]
+    bytes({0xF2, 0x0F, 0x10, static_cast<uint8_t>(0x83 | (xmm << 3))});
+    int32(8 * input);
+  }
+  void loadImmediate(int xmm, double value) { // mov rax, imm64; movq xmm, rax
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    bytes({0x48, 0xB8});
+    int64(bits);
+    bytes({0x66, 0x48, 0x0F, 0x6E, static_cast<uint8_t>(0xC0 | (xmm << 3))});
+  }
+  // Register to register SSE2 operation: prefix 0F op, dst, src.
+  void sse(uint8_t prefix, uint8_t op, int dst, int src) {
+    bytes({prefix, 0x0F, op, static_cast<uint8_t>(0xC0 | (dst << 3) | src)});
+  }
+  void callHelper(const void *function) { // mov rax, imm64; call rax
+    bytes({0x48, 0xB8});
+    int64(reinterpret_cast<uint64_t>(function));
+    bytes({0xFF, 0xD0});
+  }
+  // al = (xmm0 == xmm1), false if unordered.
+  void equalFlag() {
+    sse(0x66, 0x2E, 0, 1);     // ucomisd xmm0, xmm1
+    bytes({0x0F, 0x94, 0xC0}); // sete al
+    bytes({0x0F, 0x9B, 0xC1}); // setnp cl
+    bytes({0x20, 0xC8});       // and al, cl
+  }
+  // al = xmm0 < xmm1, or xmm0 > xmm1; false if unordered.
+  void lessFlag() {
+    sse(0x66, 0x2E, 1, 0);     // ucomisd xmm1, xmm0
+    bytes({0x0F, 0x97, 0xC0}); // seta al
+  }
+  void greaterFlag() {
+    sse(0x66, 0x2E, 0, 1);     // ucomisd xmm0, xmm1
+    bytes({0x0F, 0x97, 0xC0}); // seta al
+  }
+  void invertFlag() { bytes({0x34, 0x01}); } // xor al, 1
+  void flagToNumber() {
+    bytes({0x0F, 0xB6, 0xC0});       // movzx eax, al
+    bytes({0xF2, 0x0F, 0x2A, 0xC0}); // cvtsi2sd xmm0, eax
+  }
+  void jumpTo(size_t target) { // jmp rel32
+    byte(0xE9);
+    fixups.emplace_back(code.size(), target);
+    int32(0);
+  }
+  void jumpIfZeroFlag(size_t target) { // je rel32
+    bytes({0x0F, 0x84});
+    fixups.emplace_back(code.size(), target);
+    int32(0);
+  }
+
+  // Where the value of each stack slot is while code is emitted. Pushing a local, a
+  // global, an input or a constant only records where to read it from, and the result of the
+  // last operation stays in xmm0 while it is on top of the stack. Slots are written
+  // to the frame when that is no longer possible, and all of them before jumps and
+  // at jump targets, where the frame holds the whole stack.
+  enum class Where : uint8_t { FRAME, LOCAL, GLOBAL, INPUT, IMMEDIATE, XMM0 };
+  struct Operand {
+    Where where;
+    int index;
+    double value;
+  };
+  std::vector<Operand> operands;
+
+  void fetch(int xmm, const Operand &operand) {
+    switch (operand.where) {
+    case Where::FRAME:
+    case Where::LOCAL:
+      load(xmm, operand.index);
+      break;
+    case Where::GLOBAL:
+      loadGlobal(xmm, operand.index);
+      break;
+    case Where::INPUT:
+      loadInput(xmm, operand.index);
+      break;
+    case Where::IMMEDIATE:
+      loadImmediate(xmm, operand.value);
+      break;
+    case Where::XMM0:
+      if (xmm != 0) sse(0x66, 0x28, xmm, 0); // movapd xmm, xmm0
+      break;
+    }
+  }
+  // Write slot p to the frame. Uses xmm1, so that xmm0 survives.
+  void writeBack(size_t p) {
+    Operand &operand = operands[p];
+    if (operand.where == Where::FRAME) return;
+    if (operand.where == Where::XMM0) {
+      store(0, static_cast<int>(p));
+    } else {
+      fetch(1, operand);
+      store(1, static_cast<int>(p));
+    }
+    operand = {Where::FRAME, static_cast<int>(p), 0.0};
+  }
+  void flush() {
+    for (size_t p = 0; p < operands.size(); p++) writeBack(p);
+  }
+  // Only the top slot may be in xmm0, so it is written back before a push.
+  void push(const Operand &operand) {
+    if (!operands.empty() && operands.back().where == Where::XMM0) {
+      writeBack(operands.size() - 1);
+    }
+    operands.push_back(operand);
+  }
+  // Replace the top `count` slots with the result in xmm0.
+  void produce(size_t count) {
+    operands.resize(operands.size() - count);
+    operands.push_back({Where::XMM0, 0, 0.0});
+  }
+  // A local or global is about to change: slots still reading it need its old value.
+  void detach(Where where, int index) {
+    for (size_t p = 0; p < operands.size(); p++) {
+      if (operands[p].where == where && operands[p].index == index) writeBack(p);
+    }
+  }
+  Operand immediate(double value) const { return {Where::IMMEDIATE, 0, value}; }
+  Operand constant(uint32_t index) const {
+    return immediate(static_cast<double>(AS_NUMBER(chunk->constants[index])));
+  }
+  // Operand reading local `slot`.
+  Operand local(int slot) {
+    if (operands[slot].where == Where::XMM0) writeBack(slot);
+    if (operands[slot].where == Where::FRAME) return {Where::LOCAL, slot, 0.0};
+    return operands[slot];
+  }
+  void setLocal(int slot) {
+    detach(Where::LOCAL, slot);
+    fetch(0, operands.back());
+    store(0, slot);
+    if (static_cast<size_t>(slot) + 1 < operands.size()) {
+      operands[slot] = {Where::FRAME, slot, 0.0};
+    }
+  }
+  // Store the top slot to global `global`, leaving it on the stack.
+  void setGlobal(int global) {
+    detach(Where::GLOBAL, global);
+    fetch(0, operands.back());
+    storeGlobal(0, global);
+  }
+
+  using Unary = double (*)(double);
+  using Binary = double (*)(double, double);
+  // Helpers computing exactly what the interpreter computes.
+  static Unary unaryHelper(uint8_t op) {
+    switch (op) {
+    case OpCode::EXP: return [](double x) { return std::exp(x); };
+    case OpCode::SIN: return [](double x) { return pips::sin(x); };
+    case OpCode::COS: return [](double x) { return pips::cos(x); };
+    case OpCode::TAN: return [](double x) { return pips::tan(x); };
+    case OpCode::ABS: return [](double x) { return std::abs(x); };
+    case OpCode::LOG: return [](double x) { return std::log(x); };
+    case OpCode::LOG10: return [](double x) { return std::log10(x); };
+    case OpCode::SIGN: return [](double x) { return x < 0.0 ? -1.0 : 1.0; };
+    case OpCode::ACOS: return [](double x) { return std::acos(x); };
+    case OpCode::ASIN: return [](double x) { return std::asin(x); };
+    case OpCode::ATAN: return [](double x) { return std::atan(x); };
+    case OpCode::CEIL: return [](double x) { return std::ceil(x); };
+    case OpCode::FLOOR: return [](double x) { return std::floor(x); };
+    default: return nullptr;
+    }
+  }
+  static Binary binaryHelper(uint8_t op) {
+    switch (checkedOp(op)) {
+    case OpCode::INTDIVIDE:
+      return [](double a, double b) { return static_cast<double>(static_cast<int>(a / b)); };
+    case OpCode::MOD:
+      return [](double a, double b) {
+        return static_cast<double>(static_cast<int>(a) % static_cast<int>(b));
+      };
+    case OpCode::POW: return [](double a, double b) { return std::pow(a, b); };
+    case OpCode::ATAN2: return [](double a, double b) { return std::atan2(a, b); };
+    case OpCode::MIN: return [](double a, double b) { return std::min(a, b); };
+    case OpCode::MAX: return [](double a, double b) { return std::max(a, b); };
+    default: return nullptr;
+    }
+  }
+
+  // Load the top two slots into xmm0 (left) and xmm1 (right).
+  void operandsToXmm() {
+    fetch(1, operands.back());
+    fetch(0, operands[operands.size() - 2]);
+  }
+
+  void emitInstruction(size_t i) {
+    const auto &bytecode = chunk->code;
+    const uint8_t op = bytecode[i];
+    if (Analysis::isUnaryMath(op)) {
+      fetch(0, operands.back());
+      if (op == OpCode::SQRT) {
+        sse(0xF2, 0x51, 0, 0); // sqrtsd xmm0, xmm0
+      } else {
+        callHelper(reinterpret_cast<const void *>(unaryHelper(op)));
+      }
+      produce(1);
+      return;
+    }
+    if (Analysis::isBinaryMath(op)) {
+      operandsToXmm();
+      switch (checkedOp(op)) {
+      case OpCode::ADD:
+        sse(0xF2, 0x58, 0, 1);
+        break;
+      case OpCode::SUBTRACT:
+        sse(0xF2, 0x5C, 0, 1);
+        break;
+      case OpCode::MULTIPLY:
+        sse(0xF2, 0x59, 0, 1);
+        break;
+      case OpCode::DIVIDE:
+        sse(0xF2, 0x5E, 0, 1);
+        break;
+      default:
+        callHelper(reinterpret_cast<const void *>(binaryHelper(op)));
+      }
+      produce(2);
+      return;
+    }
+    const auto &types = analysis.typesAt[i];
+    switch (narrowOp(op)) {
+    case OpCode::NEGATE:
+    case OpCode::NEGATE_NUM:
+      fetch(0, operands.back());
+      loadImmediate(1, -0.0);
+      sse(0x66, 0x57, 0, 1); // xorpd xmm0, xmm1
+      produce(1);
+      break;
+    case OpCode::UPLUS:
+      break;
+    case OpCode::CONSTANT:
+      push(constant(operandAt(bytecode, i)));
+      break;
+    case OpCode::TRUE:
+    case OpCode::FALSE:
+      push(immediate((op == OpCode::TRUE) ? 1.0 : 0.0));
+      break;
+    case OpCode::GET_INPUT:
+      push({Where::INPUT, bytecode[i + 1], 0.0});
+      break;
+    case OpCode::GET_LOCAL:
+      push(local(operandAt(bytecode, i)));
+      break;
+    case OpCode::SET_LOCAL:
+      setLocal(operandAt(bytecode, i));
+      break;
+    case OpCode::POP:
+      operands.pop_back();
+      break;
+    case OpCode::GET_GLOBAL:
+      push({Where::GLOBAL, static_cast<int>(analysis.globalIndex(i)), 0.0});
+      break;
+    case OpCode::SET_GLOBAL:
+      setGlobal(static_cast<int>(analysis.globalIndex(i)));
+      break;
+    case OpCode::DEFINE_GLOBAL:
+      setGlobal(static_cast<int>(analysis.globalIndex(i)));
+      operands.pop_back();
+      break;
+    case OpCode::LESS:
+    case OpCode::GREATER_EQUAL:
+      operandsToXmm();
+      lessFlag();
+      if (op == OpCode::GREATER_EQUAL) invertFlag();
+      flagToNumber();
+      produce(2);
+      break;
+    case OpCode::GREATER:
+    case OpCode::LESS_EQUAL:
+      operandsToXmm();
+      greaterFlag();
+      if (op == OpCode::LESS_EQUAL) invertFlag();
+      flagToNumber();
+      produce(2);
+      break;
+    case OpCode::EQUAL:
+    case OpCode::NOT_EQUAL:
+      if (types[types.size() - 2] != types.back()) {
+        // A number never equals a boolean.
+        operands.resize(operands.size() - 2);
+        push(immediate((op == OpCode::EQUAL) ? 0.0 : 1.0));
+        break;
+      }
+      operandsToXmm();
+      equalFlag();
+      if (op == OpCode::NOT_EQUAL) invertFlag();
+      flagToNumber();
+      produce(2);
+      break;
+    case OpCode::NOT:
+      // Falsey values are false and numbers equal to zero.
+      fetch(0, operands.back());
+      sse(0x66, 0x57, 1, 1); // xorpd xmm1, xmm1
+      equalFlag();
+      flagToNumber();
+      produce(1);
+      break;
+    case OpCode::JUMP_IF_FALSE:
+      flush();
+      load(0, static_cast<int>(operands.size()) - 1);
+      sse(0x66, 0x57, 1, 1); // xorpd xmm1, xmm1
+      sse(0x66, 0x2E, 0, 1); // ucomisd xmm0, xmm1
+      bytes({0x7A, 0x06});   // jp over the je: NaN is truthy
+      jumpIfZeroFlag(jumpTarget(bytecode, i));
+      break;
+    case OpCode::JUMP:
+    case OpCode::LOOP:
+      flush();
+      jumpTo(jumpTarget(bytecode, i));
+      break;
+    case OpCode::ADD_LOCAL_CONST:
+      push(local(bytecode[i + 1]));
+      push(constant(bytecode[i + 2]));
+      operandsToXmm();
+      sse(0xF2, 0x58, 0, 1);
+      produce(2);
+      break;
+    case OpCode::MULTIPLY_LOCALS:
+      push(local(bytecode[i + 1]));
+      push(local(bytecode[i + 2]));
+      operandsToXmm();
+      sse(0xF2, 0x59, 0, 1);
+      produce(2);
+      break;
+    case OpCode::SET_LOCAL_CONST:
+      push(constant(bytecode[i + 2]));
+      setLocal(bytecode[i + 1]);
+      produce(1);
+      break;
+    case OpCode::LESS_JUMP_IF_FALSE:
+      operandsToXmm();
+      lessFlag();
+      bytes({0x88, 0xC2}); // mov dl, al
+      flagToNumber();
+      produce(2);
+      flush();
+      bytes({0x84, 0xD2}); // test dl, dl
+      jumpIfZeroFlag(jumpTarget(bytecode, i));
+      break;
+    case OpCode::RETURN:
+      if (!operands.empty()) {
+        fetch(0, operands.back());
+      } else {
+        sse(0x66, 0x57, 0, 0); // xorpd xmm0, xmm0
+      }
+      bytes({0x41, 0x5D}); // pop r13
+      bytes({0x41, 0x5C}); // pop r12
+      bytes({0x5B});       // pop rbx
+      bytes({0xC3});       // ret
+      break;
+    }
+  }
+
+  // Native code for `chunk_`, or nullptr if it cannot be compiled.
+  std::unique_ptr<NativeCode> compile(const Chunk &chunk_) {
+#if PIPS_JIT_AVAILABLE
+    if constexpr (!std::is_same_v<Real, double>) {
+      return nullptr;
+    } else {
+      chunk = &chunk_;
+      analysis.allowGlobals = true;
+      if (!analysis.analyze(chunk_)) return nullptr;
+
+      code.clear();
+      fixups.clear();
+      labels.assign(chunk->code.size(), -1);
+      // Three pushes after the return address keep calls 16-byte aligned.
+      bytes({0x53});             // push rbx
+      bytes({0x41, 0x54});       // push r12
+      bytes({0x41, 0x55});       // push r13
+      bytes({0x48, 0x89, 0xFB}); // mov rbx, rdi
+      bytes({0x49, 0x89, 0xF4}); // mov r12, rsi
+      bytes({0x49, 0x89, 0xD5}); // mov r13, rdx
+      operands.clear();
+      bool fallsThrough = true;
+      for (size_t i = 0; i < chunk->code.size(); i += instructionLength(chunk->code[i])) {
+        if (!analysis.reached[i]) continue;
+        if (analysis.targets[i]) {
+          if (fallsThrough) flush();
+          operands.clear();
+          for (size_t p = 0; p < analysis.typesAt[i].size(); p++) {
+            operands.push_back({Where::FRAME, static_cast<int>(p), 0.0});
+          }
+        }
+        labels[i] = static_cast<int>(code.size());
+        emitInstruction(i);
+        const uint8_t op = narrowOp(chunk->code[i]);
+        fallsThrough = op != OpCode::JUMP && op != OpCode::LOOP && op != OpCode::RETURN;
+      }
+      for (const auto &[at, target] : fixups) {
+        const int32_t rel = labels[target] - static_cast<int32_t>(at + 4);
+        std::memcpy(&code[at], &rel, sizeof rel);
+      }
+
+      auto native = std::make_unique<NativeCode>();
+      void *memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (memory == MAP_FAILED) return nullptr;
+      std::memcpy(memory, code.data(), code.size());
+      if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, code.size());
+        return nullptr;
+      }
+      native->memory = memory;
+      native->size = code.size();
+      native->function = reinterpret_cast<NativeCode::Function>(memory);
+      native->result = analysis.result;
+      native->maxDepth = analysis.maxDepth;
+      native->globalSlots = analysis.globalSlots;
+      native->entryGlobals = analysis.entryGlobals;
+      native->exitGlobals = analysis.exitGlobals;
+      return native;
+    }
+#else
+    (void)chunk_;
+    return nullptr;
+#endif
+  }
+};
+
+} // namespace pips
+#endif // PIPS_JIT_HPP_
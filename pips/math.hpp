@@ -9,65 +9,68 @@
 namespace pips {
 
 // These are special implementations to return exactly 0 or 1 for special values
+template <typename Real>
 inline Real sin(Real x) {
-    const Real pi = std::acos(-1.0L);
-    const Real epsilon = std::numeric_limits<Real>::epsilon() * 100.0L;
-    
-    Real normalized = std::fmod(x, 2.0L * pi);
-    if (normalized > pi) normalized -= 2.0L * pi;
-    if (normalized < -pi) normalized += 2.0L * pi;
-    
+    const Real pi = std::acos(Real(-1));
+    const Real epsilon = std::numeric_limits<Real>::epsilon() * Real(100);
+
+    Real normalized = std::fmod(x, Real(2) * pi);
+    if (normalized > pi) normalized -= Real(2) * pi;
+    if (normalized < -pi) normalized += Real(2) * pi;
+
     if (std::abs(normalized) < epsilon || std::abs(std::abs(normalized) - pi) < epsilon) {
-        return 0.0L;
+        return Real(0);
     }
-    
-    if (std::abs(normalized - pi/2.0L) < epsilon) {
-        return 1.0L;
+
+    if (std::abs(normalized - pi/Real(2)) < epsilon) {
+        return Real(1);
     }
-    
-    if (std::abs(normalized + pi/2.0L) < epsilon) {
-        return -1.0L;
+
+    if (std::abs(normalized + pi/Real(2)) < epsilon) {
+        return Real(-1);
     }
-    
+
     return std::sin(x);
 }
 
+template <typename Real>
 inline Real cos(Real x) {
-    const Real pi = std::acos(-1.0L);
-    const Real epsilon = std::numeric_limits<Real>::epsilon() * 100.0L;
-    
-    Real normalized = std::fmod(x, 2.0L * pi);
-    if (normalized > pi) normalized -= 2.0L * pi;
-    if (normalized < -pi) normalized += 2.0L * pi;
-    
+    const Real pi = std::acos(Real(-1));
+    const Real epsilon = std::numeric_limits<Real>::epsilon() * Real(100);
+
+    Real normalized = std::fmod(x, Real(2) * pi);
+    if (normalized > pi) normalized -= Real(2) * pi;
+    if (normalized < -pi) normalized += Real(2) * pi;
+
     if (std::abs(normalized) < epsilon) {
-        return 1.0L;
+        return Real(1);
     }
     if (std::abs(std::abs(normalized) - pi) < epsilon) {
-        return -1.0L;
+        return Real(-1);
     }
-    if (std::abs(std::abs(normalized) - pi/2.0L) < epsilon) {
-        return 0.0L;
+    if (std::abs(std::abs(normalized) - pi/Real(2)) < epsilon) {
+        return Real(0);
     }
-    
+
     return std::cos(x);
 }
 
+template <typename Real>
 inline Real tan(Real x) {
-    const Real pi = std::acos(-1.0L);
-    const Real epsilon = std::numeric_limits<Real>::epsilon() * 100.0L;
-    
+    const Real pi = std::acos(Real(-1));
+    const Real epsilon = std::numeric_limits<Real>::epsilon() * Real(100);
+
     Real normalized = std::fmod(x, pi);
-    if (normalized >= pi/2.0L) normalized -= pi;
-    if (normalized < -pi/2.0L) normalized += pi;
-    
+    if (normalized >= pi/Real(2)) normalized -= pi;
+    if (normalized < -pi/Real(2)) normalized += pi;
+
     if (std::abs(normalized) < epsilon) {
-        return 0.0L;
+        return Real(0);
     }
-    
+
     return std::tan(x);
 }
 
 } // namespace pips
 
-#endif // PIPS_MATH_HPP_
\ No newline at end of file
+#endif // PIPS_MATH_HPP_
@@ -0,0 +1,294 @@
+#ifndef PIPS_NUMERIC_HPP_
+#define PIPS_NUMERIC_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "chunk.hpp"
+#include "value.hpp"
+
+namespace pips {
+
+// Static type of a stack slot in numeric code, or of its result (NIL if the script
+// leaves nothing on the stack).
+enum class NumericType : uint8_t { NIL, NUMBER, BOOL };
+
+// Type inference for the compilers that translate a chunk out of the VM (the JIT and
+// the C++ generator). A chunk is numeric if every reachable instruction works on
+// numbers and booleans only: inputs (assumed to be numbers), locals, numeric
+// constants, arithmetic, comparisons, math builtins and jumps. Anything else
+// (strings, nil, printing, bitwise operators), an operation that could fail with a
+// type error, or control flow joining different slot types is rejected.
+//
+// Globals are accepted when `allowGlobals` is set and they only ever hold numbers.
+// A global read or assigned before the chunk defines it must already hold a number
+// when the code starts (see entryGlobals); the caller checks that before each run.
+// Paths may only join where the same globals have been defined.
+template <typename Real = DefaultReal>
+struct NumericAnalysis {
+  using Chunk = pips::Chunk<Real>;
+
+  const Chunk *chunk = nullptr;
+  // Slot types before each reachable instruction; empty where unreachable.
+  std::vector<std::vector<NumericType>> typesAt;
+  std::vector<uint8_t> reached;
+  // Instructions some jump goes to.
+  std::vector<uint8_t> targets;
+  NumericType result = NumericType::NIL;
+  int maxDepth = 0;
+
+  bool allowGlobals = false;
+  // VM slot of each global the chunk uses; the code refers to them by position.
+  std::vector<uint16_t> globalSlots;
+  // Globals read or assigned before any definition, which must hold numbers on
+  // entry, and globals defined by the time the code returns.
+  std::vector<uint8_t> entryGlobals;
+  std::vector<uint8_t> exitGlobals;
+  // Globals defined so far before each reachable instruction.
+  std::vector<std::vector<uint8_t>> definedAt;
+
+  NumericAnalysis() = default;
+  ~NumericAnalysis() = default;
+
+  static bool isNumber(const Chunk &chunk, uint32_t constant) {
+    return IS_NUMBER(chunk.constants[constant]);
+  }
+  static bool isUnaryMath(uint8_t op) {
+    switch (op) {
+    case OpCode::EXP:
+    case OpCode::SIN:
+    case OpCode::COS:
+    case OpCode::TAN:
+    case OpCode::ABS:
+    case OpCode::LOG:
+    case OpCode::LOG10:
+    case OpCode::SIGN:
+    case OpCode::SQRT:
+    case OpCode::ACOS:
+    case OpCode::ASIN:
+    case OpCode::ATAN:
+    case OpCode::CEIL:
+    case OpCode::FLOOR:
+      return true;
+    default:
+      return false;
+    }
+  }
+  static bool isBinaryMath(uint8_t op) {
+    switch (checkedOp(op)) {
+    case OpCode::ADD:
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE:
+    case OpCode::INTDIVIDE:
+    case OpCode::MOD:
+    case OpCode::POW:
+    case OpCode::ATAN2:
+    case OpCode::MIN:
+    case OpCode::MAX:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  uint16_t globalSlot(size_t i) const {
+    return static_cast<uint16_t>((chunk->code[i + 1] << 8) | chunk->code[i + 2]);
+  }
+  // Position in globalSlots of the global used by instruction i.
+  size_t globalIndex(size_t i) const {
+    const uint16_t slot = globalSlot(i);
+    return std::find(globalSlots.begin(), globalSlots.end(), slot) - globalSlots.begin();
+  }
+
+  // Slot types and defined globals after instruction i, given those before it.
+  // Returns false for instructions that cannot be compiled with these operand types.
+  bool transfer(size_t i, std::vector<NumericType> &types, std::vector<uint8_t> &defined) {
+    const auto &bytes = chunk->code;
+    const uint8_t op = bytes[i];
+    auto numbers = [&](size_t count) {
+      if (types.size() < count) return false;
+      for (size_t k = 1; k <= count; k++) {
+        if (types[types.size() - k] != NumericType::NUMBER) return false;
+      }
+      return true;
+    };
+    if (isUnaryMath(op) || checkedOp(op) == OpCode::NEGATE || op == OpCode::UPLUS) {
+      return numbers(1);
+    }
+    if (isBinaryMath(op)) {
+      if (!numbers(2)) return false;
+      types.pop_back();
+      return true;
+    }
+    switch (narrowOp(op)) {
+    case OpCode::CONSTANT:
+      if (!isNumber(*chunk, operandAt(bytes, i))) return false;
+      types.push_back(NumericType::NUMBER);
+      return true;
+    case OpCode::TRUE:
+    case OpCode::FALSE:
+      types.push_back(NumericType::BOOL);
+      return true;
+    case OpCode::GET_INPUT:
+      types.push_back(NumericType::NUMBER);
+      return true;
+    case OpCode::GET_LOCAL: {
+      const uint32_t slot = operandAt(bytes, i);
+      if (slot >= types.size()) return false;
+      types.push_back(types[slot]);
+      return true;
+    }
+    case OpCode::SET_LOCAL: {
+      const uint32_t slot = operandAt(bytes, i);
+      if (types.empty() || slot >= types.size()) return false;
+      types[slot] = types.back();
+      return true;
+    }
+    case OpCode::POP:
+      if (types.empty()) return false;
+      types.pop_back();
+      return true;
+    case OpCode::LESS:
+    case OpCode::GREATER:
+    case OpCode::LESS_EQUAL:
+    case OpCode::GREATER_EQUAL:
+      if (!numbers(2)) return false;
+      types.pop_back();
+      types.back() = NumericType::BOOL;
+      return true;
+    case OpCode::EQUAL:
+    case OpCode::NOT_EQUAL:
+      if (types.size() < 2) return false;
+      types.pop_back();
+      types.back() = NumericType::BOOL;
+      return true;
+    case OpCode::NOT:
+      if (types.empty()) return false;
+      types.back() = NumericType::BOOL;
+      return true;
+    case OpCode::JUMP_IF_FALSE:
+      return !types.empty();
+    case OpCode::JUMP:
+    case OpCode::LOOP:
+      return true;
+    case OpCode::ADD_LOCAL_CONST:
+      if (bytes[i + 1] >= types.size() || types[bytes[i + 1]] != NumericType::NUMBER ||
+          !isNumber(*chunk, bytes[i + 2])) {
+        return false;
+      }
+      types.push_back(NumericType::NUMBER);
+      return true;
+    case OpCode::MULTIPLY_LOCALS:
+      if (bytes[i + 1] >= types.size() || bytes[i + 2] >= types.size() ||
+          types[bytes[i + 1]] != NumericType::NUMBER || types[bytes[i + 2]] != NumericType::NUMBER) {
+        return false;
+      }
+      types.push_back(NumericType::NUMBER);
+      return true;
+    case OpCode::SET_LOCAL_CONST:
+      if (bytes[i + 1] >= types.size() || !isNumber(*chunk, bytes[i + 2])) return false;
+      types[bytes[i + 1]] = NumericType::NUMBER;
+      types.push_back(NumericType::NUMBER);
+      return true;
+    case OpCode::LESS_JUMP_IF_FALSE:
+      if (!numbers(2)) return false;
+      types.pop_back();
+      types.back() = NumericType::BOOL;
+      return true;
+    case OpCode::DEFINE_GLOBAL:
+      if (!numbers(1)) return false;
+      types.pop_back();
+      defined[globalIndex(i)] = 1;
+      return true;
+    case OpCode::SET_GLOBAL:
+      if (!numbers(1)) return false;
+      [[fallthrough]];
+    case OpCode::GET_GLOBAL: {
+      const size_t g = globalIndex(i);
+      if (!defined[g]) entryGlobals[g] = 1;
+      if (op == OpCode::GET_GLOBAL) types.push_back(NumericType::NUMBER);
+      return true;
+    }
+    case OpCode::RETURN:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Infer the slot types before every reachable instruction. Control flow may only
+  // join with identical types.
+  bool inferTypes() {
+    const auto &bytes = chunk->code;
+    typesAt.assign(bytes.size(), {});
+    definedAt.assign(bytes.size(), {});
+    reached.assign(bytes.size(), 0);
+    std::vector<size_t> work;
+    bool consistent = true;
+    auto reach = [&](size_t i, const std::vector<NumericType> &types,
+                     const std::vector<uint8_t> &defined) {
+      if (i >= bytes.size()) {
+        consistent = false;
+      } else if (!reached[i]) {
+        reached[i] = 1;
+        typesAt[i] = types;
+        definedAt[i] = defined;
+        work.push_back(i);
+      } else if (typesAt[i] != types || definedAt[i] != defined) {
+        consistent = false;
+      }
+    };
+    reach(0, {}, std::vector<uint8_t>(globalSlots.size(), 0));
+    bool returned = false;
+    while (!work.empty() && consistent) {
+      const size_t i = work.back();
+      work.pop_back();
+      std::vector<NumericType> types = typesAt[i];
+      std::vector<uint8_t> defined = definedAt[i];
+      const uint8_t op = bytes[i];
+      if (op == OpCode::RETURN) {
+        const NumericType here = types.empty() ? NumericType::NIL : types.back();
+        if (returned && (here != result || defined != exitGlobals)) return false;
+        result = here;
+        exitGlobals = defined;
+        returned = true;
+        continue;
+      }
+      if (!transfer(i, types, defined)) return false;
+      maxDepth = std::max(maxDepth, static_cast<int>(types.size()));
+      if (isJumpOp(op)) reach(jumpTarget(bytes, i), types, defined);
+      if (narrowOp(op) != OpCode::JUMP && narrowOp(op) != OpCode::LOOP) {
+        reach(i + instructionLength(op), types, defined);
+      }
+    }
+    return consistent && returned;
+  }
+  // Whether `chunk_` is numeric; fills in the tables above if it is.
+  bool analyze(const Chunk &chunk_) {
+    chunk = &chunk_;
+    result = NumericType::NIL;
+    maxDepth = 0;
+    globalSlots.clear();
+    for (size_t i = 0; i < chunk->code.size(); i += instructionLength(chunk->code[i])) {
+      const uint8_t op = chunk->code[i];
+      if (op != OpCode::DEFINE_GLOBAL && op != OpCode::GET_GLOBAL && op != OpCode::SET_GLOBAL) {
+        continue;
+      }
+      if (!allowGlobals) return false;
+      if (globalIndex(i) == globalSlots.size()) globalSlots.push_back(globalSlot(i));
+    }
+    entryGlobals.assign(globalSlots.size(), 0);
+    exitGlobals.assign(globalSlots.size(), 0);
+    if (chunk->code.empty() || !inferTypes()) return false;
+    targets.assign(chunk->code.size(), 0);
+    for (size_t i = 0; i < chunk->code.size(); i += instructionLength(chunk->code[i])) {
+      if (reached[i] && isJumpOp(chunk->code[i])) targets[jumpTarget(chunk->code, i)] = 1;
+    }
+    return true;
+  }
+};
+
+} // namespace pips
+#endif // PIPS_NUMERIC_HPP_
@@ -0,0 +1,326 @@
+#ifndef PIPS_OPTIMIZER_HPP_
+#define PIPS_OPTIMIZER_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "arena.hpp"
+#include "chunk.hpp"
+
+namespace pips {
+
+// Peephole pass over the bytecode produced by Compiler::compile. Rewrites a chunk in
+// place, repeating until nothing changes:
+//  - EQUAL NOT, LESS NOT and GREATER NOT become NOT_EQUAL, GREATER_EQUAL and
+//    LESS_EQUAL,
+//  - jumps to unconditional jumps (and conditional jumps to conditional jumps,
+//    which test the same value) go straight to the final target,
+//  - jumps to the next instruction and unreachable code are removed,
+//  - a value pushed without side effects and popped right away is dropped.
+// Then the hot sequences local + constant, local * local, constant assigned to a
+// local and < followed by a conditional jump become superinstructions.
+// Every remaining instruction keeps its source line, so runtime errors report the
+// same line as without the pass. Instructions are decoded to their narrow opcodes
+// and re-encoded in the wide form where the operand or jump distance needs it.
+template <typename Real = DefaultReal>
+struct PeepholeOptimizer {
+  using Chunk = pips::Chunk<Real>;
+
+  struct Instruction {
+    uint8_t op;
+    uint32_t operands[2];
+    int line;
+    size_t offset; // in the original code
+    int target;    // index of the jump target, for jumps
+    bool removed;
+  };
+
+  ArenaVector<Instruction> code;
+  ArenaVector<uint8_t> isTarget;
+
+  PeepholeOptimizer() = default;
+  ~PeepholeOptimizer() = default;
+
+  static bool isConditional(uint8_t op) {
+    return op == OpCode::JUMP_IF_FALSE || op == OpCode::LESS_JUMP_IF_FALSE;
+  }
+  static bool isJump(uint8_t op) { return isJumpOp(op); }
+  // Superinstructions take a byte for each of their two operands.
+  static bool isFused(uint8_t op) {
+    return op == OpCode::ADD_LOCAL_CONST || op == OpCode::MULTIPLY_LOCALS ||
+           op == OpCode::SET_LOCAL_CONST;
+  }
+  // Pushes a value without reading anything that can fail.
+  static bool isPurePush(uint8_t op) {
+    return op == OpCode::CONSTANT || op == OpCode::NIL || op == OpCode::TRUE ||
+           op == OpCode::FALSE || op == OpCode::GET_LOCAL || op == OpCode::GET_INPUT;
+  }
+
+  void decode(const Chunk &chunk) {
+    code.clear();
+    ArenaVector<int> indexAt(chunk.code.size() + 1, -1);
+    for (size_t i = 0; i < chunk.code.size(); i += instructionLength(chunk.code[i])) {
+      indexAt[i] = static_cast<int>(code.size());
+      const uint8_t op = chunk.code[i];
+      Instruction instruction{narrowOp(op), {0, 0}, chunk.lineAt(i), i, -1, false};
+      if (isFused(op)) {
+        instruction.operands[0] = chunk.code[i + 1];
+        instruction.operands[1] = chunk.code[i + 2];
+      } else if (instructionLength(op) > 1) {
+        instruction.operands[0] = operandAt(chunk.code, i);
+      }
+      code.push_back(instruction);
+    }
+    indexAt[chunk.code.size()] = static_cast<int>(code.size());
+    for (auto &instruction : code) {
+      if (isJump(instruction.op)) {
+        instruction.target = indexAt[jumpTarget(chunk.code, instruction.offset)];
+      }
+    }
+  }
+
+  // First instruction at or after i that has not been removed.
+  int live(int i) const {
+    while (i < static_cast<int>(code.size()) && code[i].removed) i++;
+    return i;
+  }
+
+  void markTargets() {
+    isTarget.assign(code.size() + 1, 0);
+    for (auto &instruction : code) {
+      if (instruction.removed || !isJump(instruction.op)) continue;
+      instruction.target = live(instruction.target);
+      isTarget[instruction.target] = 1;
+    }
+  }
+
+  bool threadJumps() {
+    bool changed = false;
+    for (int i = 0; i < static_cast<int>(code.size()); i++) {
+      auto &jump = code[i];
+      if (jump.removed || !isJump(jump.op)) continue;
+      int target = jump.target;
+      // Bounded, so that a jump cycle (an empty infinite loop) cannot hang the pass.
+      for (size_t hops = 0; hops < code.size() && target < static_cast<int>(code.size());
+           hops++) {
+        const auto &next = code[target];
+        const bool unconditional = next.op == OpCode::JUMP || next.op == OpCode::LOOP;
+        const bool sameTest = isConditional(jump.op) && next.op == OpCode::JUMP_IF_FALSE;
+        if (!unconditional && !sameTest) break;
+        // Conditional jumps only go forward.
+        if (isConditional(jump.op) && next.target <= i) break;
+        if (next.target == target) break;
+        target = next.target;
+      }
+      if (target != jump.target) {
+        jump.target = target;
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  bool fuseAndDrop() {
+    bool changed = false;
+    for (int i = live(0); i < static_cast<int>(code.size());) {
+      const int j = live(i + 1);
+      if (j >= static_cast<int>(code.size())) break;
+      auto &first = code[i];
+      auto &second = code[j];
+      if (second.op == OpCode::NOT && !isTarget[j] &&
+          (first.op == OpCode::EQUAL || first.op == OpCode::LESS ||
+           first.op == OpCode::GREATER)) {
+        first.op = (first.op == OpCode::EQUAL)  ? OpCode::NOT_EQUAL
+                   : (first.op == OpCode::LESS) ? OpCode::GREATER_EQUAL
+                                                : OpCode::LESS_EQUAL;
+        second.removed = true;
+        changed = true;
+        continue;
+      }
+      if (second.op == OpCode::POP && !isTarget[j] && isPurePush(first.op)) {
+        first.removed = true;
+        second.removed = true;
+        changed = true;
+        i = live(j + 1);
+        continue;
+      }
+      if ((first.op == OpCode::JUMP || first.op == OpCode::JUMP_IF_FALSE) &&
+          live(first.target) == j) {
+        first.removed = true;
+        changed = true;
+      }
+      i = j;
+    }
+    return changed;
+  }
+
+  bool removeUnreachable() {
+    ArenaVector<uint8_t> reached(code.size(), 0);
+    ArenaVector<int> work{live(0)};
+    while (!work.empty()) {
+      int i = work.back();
+      work.pop_back();
+      while (i < static_cast<int>(code.size()) && !reached[i]) {
+        reached[i] = 1;
+        const uint8_t op = code[i].op;
+        if (isJump(op)) work.push_back(live(code[i].target));
+        if (op == OpCode::JUMP || op == OpCode::LOOP || op == OpCode::RETURN) break;
+        i = live(i + 1);
+      }
+    }
+    bool changed = false;
+    for (size_t i = 0; i < code.size(); i++) {
+      if (!code[i].removed && !reached[i]) {
+        code[i].removed = true;
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // Replace `first` and the `count` - 1 live instructions after it, none of them a
+  // jump target, with the superinstruction `op`. It reports errors on the line of
+  // the last one, which is the one that can fail.
+  bool fuse(int first, int count, uint8_t op, uint32_t operand0, uint32_t operand1) {
+    if (operand0 > UINT8_MAX || operand1 > UINT8_MAX) return false;
+    ArenaVector<int> group{first};
+    while (static_cast<int>(group.size()) < count) {
+      const int next = live(group.back() + 1);
+      if (next >= static_cast<int>(code.size()) || isTarget[next]) return false;
+      group.push_back(next);
+    }
+    auto &fused = code[first];
+    fused.line = code[group.back()].line;
+    fused.target = code[group.back()].target;
+    for (int k = 1; k < count; k++) code[group[k]].removed = true;
+    fused.op = op;
+    fused.operands[0] = operand0;
+    fused.operands[1] = operand1;
+    return true;
+  }
+  // Opcode of the live instruction after i, or RETURN at the end of the code.
+  uint8_t nextOp(int i, int skip = 1) const {
+    for (; skip > 0; skip--) {
+      i = live(i + 1);
+      if (i >= static_cast<int>(code.size())) return OpCode::RETURN;
+    }
+    return code[i].op;
+  }
+
+  void fuseSuperinstructions() {
+    markTargets();
+    for (int i = live(0); i < static_cast<int>(code.size()); i = live(i + 1)) {
+      const auto &first = code[i];
+      const int j = live(i + 1);
+      switch (first.op) {
+      case OpCode::GET_LOCAL:
+        if (nextOp(i) == OpCode::CONSTANT && checkedOp(nextOp(i, 2)) == OpCode::ADD) {
+          fuse(i, 3, OpCode::ADD_LOCAL_CONST, first.operands[0], code[j].operands[0]);
+        } else if (nextOp(i) == OpCode::GET_LOCAL &&
+                   checkedOp(nextOp(i, 2)) == OpCode::MULTIPLY) {
+          fuse(i, 3, OpCode::MULTIPLY_LOCALS, first.operands[0], code[j].operands[0]);
+        }
+        break;
+      case OpCode::CONSTANT:
+        if (nextOp(i) == OpCode::SET_LOCAL) {
+          fuse(i, 2, OpCode::SET_LOCAL_CONST, code[j].operands[0], first.operands[0]);
+        }
+        break;
+      case OpCode::LESS:
+        if (nextOp(i) == OpCode::JUMP_IF_FALSE) {
+          fuse(i, 2, OpCode::LESS_JUMP_IF_FALSE, 0, 0);
+        }
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  // Encoded size of an instruction; jumps flagged in `wide` take 32-bit offsets. A
+  // wide LESS_JUMP_IF_FALSE is written as LESS and JUMP_IF_FALSE_LONG.
+  static size_t encodedLength(const Instruction &instruction, bool wide) {
+    const uint8_t op = instruction.op;
+    if (isJump(op)) return wide ? 5 + (op == OpCode::LESS_JUMP_IF_FALSE) : 3;
+    if (wideOp(op) != op && instruction.operands[0] > UINT8_MAX) return 4;
+    return instructionLength(op);
+  }
+
+  void encode(Chunk &chunk) const {
+    // Widen the jumps whose distance does not fit 16 bits until none is left; code
+    // only grows, so this ends.
+    ArenaVector<uint8_t> wide(code.size(), 0);
+    ArenaVector<size_t> offsetAt(code.size() + 1);
+    for (bool widened = true; widened;) {
+      size_t offset = 0;
+      for (size_t i = 0; i < code.size(); i++) {
+        offsetAt[i] = offset;
+        if (!code[i].removed) offset += encodedLength(code[i], wide[i]);
+      }
+      offsetAt[code.size()] = offset;
+      widened = false;
+      for (size_t i = 0; i < code.size(); i++) {
+        if (code[i].removed || !isJump(code[i].op) || wide[i]) continue;
+        const size_t from = offsetAt[i] + 3;
+        const size_t to = offsetAt[code[i].target];
+        if (((to >= from) ? to - from : from - to) > UINT16_MAX) {
+          wide[i] = 1;
+          widened = true;
+        }
+      }
+    }
+    chunk.code.clear();
+    chunk.lines.clear();
+    for (size_t i = 0; i < code.size(); i++) {
+      const auto &instruction = code[i];
+      if (instruction.removed) continue;
+      uint8_t op = instruction.op;
+      if (isJump(op)) {
+        if (wide[i] && op == OpCode::LESS_JUMP_IF_FALSE) {
+          chunk.write(OpCode::LESS, instruction.line);
+          op = OpCode::JUMP_IF_FALSE;
+        }
+        // Threading can turn a forward jump into a backward one and vice versa.
+        const size_t from = offsetAt[i] + encodedLength(instruction, wide[i]);
+        const size_t to = offsetAt[instruction.target];
+        if (!isConditional(op)) op = (to >= from) ? OpCode::JUMP : OpCode::LOOP;
+        const size_t distance = (to >= from) ? to - from : from - to;
+        writeOperand(chunk, wide[i] ? wideOp(op) : op, static_cast<uint32_t>(distance),
+                     instruction.line);
+      } else if (isFused(op)) {
+        chunk.write(op, instruction.line);
+        chunk.write(static_cast<uint8_t>(instruction.operands[0]), instruction.line);
+        chunk.write(static_cast<uint8_t>(instruction.operands[1]), instruction.line);
+      } else {
+        const bool wideIndex = wideOp(op) != op && instruction.operands[0] > UINT8_MAX;
+        writeOperand(chunk, wideIndex ? wideOp(op) : op, instruction.operands[0],
+                     instruction.line);
+      }
+    }
+  }
+  // Writes op followed by its big-endian operand, if it has one.
+  static void writeOperand(Chunk &chunk, uint8_t op, uint32_t operand, int line) {
+    chunk.write(op, line);
+    for (int k = instructionLength(op) - 2; k >= 0; k--) {
+      chunk.write(static_cast<uint8_t>((operand >> (8 * k)) & 0xff), line);
+    }
+  }
+
+  void optimize(Chunk &chunk) {
+    decode(chunk);
+    bool changed = true;
+    while (changed) {
+      markTargets();
+      changed = threadJumps();
+      markTargets();
+      changed |= fuseAndDrop();
+      changed |= removeUnreachable();
+    }
+    fuseSuperinstructions();
+    encode(chunk);
+    chunk.maxDepth = chunk.computeMaxDepth();
+  }
+};
+
+} // namespace pips
+#endif // PIPS_OPTIMIZER_HPP_
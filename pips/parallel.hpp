@@ -0,0 +1,90 @@
+#ifndef PIPS_PARALLEL_HPP_
+#define PIPS_PARALLEL_HPP_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "batch.hpp"
+#include "context.hpp"
+#include "program.hpp"
+#include "thread_pool.hpp"
+#include "vm.hpp"
+
+namespace pips {
+
+// Evaluates a compiled program over columns of inputs on a work-stealing thread
+// pool. The columns are split into ranges of grainSize elements; each pool
+// participant evaluates ranges with its own Context and BatchEvaluator and writes
+// the results straight into the output array. Every run starts from a copy of the
+// VM's globals, so the VM must not run anything while evaluate() is in progress.
+template <typename Real = DefaultReal>
+struct ParallelBatchEvaluator {
+  using Program = pips::Program<Real>;
+  using VM = pips::VM<Real>;
+  using Context = pips::Context<Real>;
+  using BatchEvaluator = pips::BatchEvaluator<Real>;
+
+  static constexpr size_t DEFAULT_GRAIN = 16 * BatchEvaluator::BLOCK_SIZE;
+
+  VM *vm;
+  std::unique_ptr<ThreadPool> ownedPool;
+  ThreadPool *pool;
+  size_t grainSize;
+
+  // Per-participant state, indexed by the pool's worker number.
+  std::vector<std::unique_ptr<Context>> contexts;
+  std::vector<std::unique_ptr<BatchEvaluator>> evaluators;
+  std::vector<std::vector<const Real *>> columnViews;
+
+  // Use `threads` threads including the caller; 0 uses every hardware thread.
+  explicit ParallelBatchEvaluator(VM &vm_, size_t threads = 0)
+      : vm(&vm_), ownedPool(std::make_unique<ThreadPool>(threads)), pool(ownedPool.get()),
+        grainSize(DEFAULT_GRAIN) {
+    init();
+  }
+  // Share an existing pool, e.g. between evaluators of several programs.
+  ParallelBatchEvaluator(VM &vm_, ThreadPool &pool_)
+      : vm(&vm_), pool(&pool_), grainSize(DEFAULT_GRAIN) {
+    init();
+  }
+  ~ParallelBatchEvaluator() = default;
+
+  void init() {
+    for (size_t i = 0; i < pool->concurrency(); i++) {
+      contexts.push_back(std::make_unique<Context>(*vm));
+      evaluators.push_back(std::make_unique<BatchEvaluator>(*contexts.back()));
+    }
+    columnViews.resize(pool->concurrency());
+  }
+
+  size_t threads() const { return pool->concurrency(); }
+  // Elements per task. Smaller grains balance better, larger ones cost less
+  // scheduling; multiples of BatchEvaluator::BLOCK_SIZE avoid partial blocks.
+  void setGrainSize(size_t grain) { grainSize = (grain == 0) ? 1 : grain; }
+
+  // Same contract as BatchEvaluator::evaluate. If elements fail, the status of one
+  // failing range is returned and the other results are still written.
+  InterpretResult evaluate(const Program &program, const Real *const *columns, Real *out,
+                           size_t n) {
+    for (auto &context : contexts) {
+      context->copyGlobals(*vm);
+    }
+    const size_t count = program.inputs.size();
+    std::atomic<InterpretResult> status{InterpretResult::OK};
+    pool->parallelFor(n, grainSize, [&](size_t worker, size_t begin, size_t end) {
+      auto &view = columnViews[worker];
+      view.resize(count);
+      for (size_t i = 0; i < count; i++) {
+        view[i] = columns[i] + begin;
+      }
+      auto result =
+          evaluators[worker]->evaluate(program, view.data(), out + begin, end - begin, begin);
+      if (result != InterpretResult::OK) status.store(result);
+    });
+    return status.load();
+  }
+};
+
+} // namespace pips
+#endif // PIPS_PARALLEL_HPP_
@@ -0,0 +1,59 @@
+#ifndef PIPS_PROFILE_HPP_
+#define PIPS_PROFILE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "chunk.hpp"
+
+namespace pips {
+
+// How often each opcode was directly followed by each other opcode in the stack
+// VM. Contexts only record a profile when built with PIPS_OPCODE_PROFILE, since
+// counting costs a memory increment per instruction. The most frequent pairs are
+// the candidates for superinstructions.
+struct OpcodeProfile {
+  std::array<uint64_t, OPCODE_COUNT * OPCODE_COUNT> pairs{};
+  int previous = -1;
+
+  OpcodeProfile() = default;
+  ~OpcodeProfile() = default;
+
+  // A new run starts; its first opcode does not pair with the last one before.
+  void start() { previous = -1; }
+  void record(uint8_t op) {
+    if (previous >= 0) pairs[previous * OPCODE_COUNT + op]++;
+    previous = op;
+  }
+  void clear() {
+    pairs.fill(0);
+    previous = -1;
+  }
+  uint64_t count(uint8_t first, uint8_t second) const {
+    return pairs[first * OPCODE_COUNT + second];
+  }
+
+  // Print the `limit` most frequent pairs with their share of all pairs.
+  void report(FILE *out = stderr, size_t limit = 20) const {
+    uint64_t total = 0;
+    std::vector<int> order;
+    for (int i = 0; i < OPCODE_COUNT * OPCODE_COUNT; i++) {
+      total += pairs[i];
+      if (pairs[i] > 0) order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return pairs[a] > pairs[b]; });
+    if (order.size() > limit) order.resize(limit);
+    std::fprintf(out, "== opcode pairs (%llu) ==\n", static_cast<unsigned long long>(total));
+    for (int i : order) {
+      std::fprintf(out, "%-18s %-18s %12llu %6.2f%%\n", opcodeName(i / OPCODE_COUNT),
+                   opcodeName(i % OPCODE_COUNT), static_cast<unsigned long long>(pairs[i]),
+                   100.0 * static_cast<double>(pairs[i]) / static_cast<double>(total));
+    }
+  }
+};
+
+} // namespace pips
+#endif // PIPS_PROFILE_HPP_
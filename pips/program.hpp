@@ -0,0 +1,54 @@
+#ifndef PIPS_PROGRAM_HPP_
+#define PIPS_PROGRAM_HPP_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chunk.hpp"
+#include "jit.hpp"
+#include "register.hpp"
+
+namespace pips {
+
+// A compiled script. Holds the chunk (code, constants and line table) produced by
+// VM::compile so that it can be executed any number of times with VM::run without
+// scanning or parsing the source again. Programs compiled for the register backend
+// also carry the register code translated from the chunk, which is what runs, and
+// native programs the machine code of the chunk if the JIT could compile it.
+template <typename Real = DefaultReal>
+struct Program {
+  Chunk<Real> chunk;
+  char end_line = ';';
+  // Host supplied input variables declared at compile time. Input i is read from
+  // element i of the input frame passed to VM::run.
+  std::vector<std::string> inputs;
+  Backend backend = Backend::STACK;
+  RegisterChunk<Real> registerCode;
+  std::shared_ptr<const NativeCode> native;
+  // Pool of the string constants, which lives as long as the program.
+  std::shared_ptr<StringPool> strings;
+
+  Program() = default;
+  ~Program() = default;
+
+  // Index of an input in the input frame, or -1 if it was not declared.
+  int inputSlot(std::string_view name) const {
+    for (size_t i = 0; i < inputs.size(); i++) {
+      if (inputs[i] == name) return static_cast<int>(i);
+    }
+    return -1;
+  }
+
+  void disassemble(std::string name) const {
+    if (backend == Backend::REGISTER) {
+      registerCode.disassemble(name);
+    } else {
+      chunk.disassemble(name);
+    }
+  }
+};
+
+} // namespace pips
+#endif // PIPS_PROGRAM_HPP_
@@ -0,0 +1,502 @@
+#ifndef PIPS_REGISTER_HPP_
+#define PIPS_REGISTER_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "chunk.hpp"
+#include "value.hpp"
+
+namespace pips {
+
+// Executor a compiled program runs on. NATIVE programs run as machine code from the
+// JIT (see jit.hpp) where it can compile them, and on the stack VM otherwise.
+enum class Backend : uint8_t { STACK, REGISTER, NATIVE };
+
+// Three-address instructions of the register backend. Operand a is the destination
+// (a register, a global slot or a jump target) and b and c are source registers:
+//   MOVE         R[a] = R[b]
+//   unary ops    R[a] = op R[b]
+//   binary ops   R[a] = R[b] op R[c]
+//   GET_GLOBAL   R[a] = global b
+//   SET_GLOBAL,
+//   DEFINE_GLOBAL  global a = R[b]
+//   JUMP         jump to instruction a
+//   JUMP_IF_FALSE  jump to instruction a if R[b] is falsey
+//   PRINT, RETURN  R[b]
+//   LIST         a is the number of live stack registers
+#define PIPS_REGISTER_OPCODES(X) \
+  X(MOVE) \
+  X(NEGATE) \
+  X(UPLUS) \
+  X(NOT) \
+  X(BNOT) \
+  X(EXP) \
+  X(SIN) \
+  X(COS) \
+  X(TAN) \
+  X(ABS) \
+  X(LOG) \
+  X(LOG10) \
+  X(SIGN) \
+  X(SQRT) \
+  X(ACOS) \
+  X(ASIN) \
+  X(ATAN) \
+  X(CEIL) \
+  X(FLOOR) \
+  X(ADD) \
+  X(SUBTRACT) \
+  X(MULTIPLY) \
+  X(DIVIDE) \
+  X(INTDIVIDE) \
+  X(MOD) \
+  X(POW) \
+  X(ATAN2) \
+  X(MIN) \
+  X(MAX) \
+  X(XOR) \
+  X(BOR) \
+  X(BAND) \
+  X(LSHIFT) \
+  X(RSHIFT) \
+  X(EQUAL) \
+  X(GREATER) \
+  X(LESS) \
+  X(NOT_EQUAL) \
+  X(GREATER_EQUAL) \
+  X(LESS_EQUAL) \
+  X(DEFINE_GLOBAL) \
+  X(GET_GLOBAL) \
+  X(SET_GLOBAL) \
+  X(PRINT) \
+  X(NEWLINE) \
+  X(LIST) \
+  X(JUMP) \
+  X(JUMP_IF_FALSE) \
+  X(RETURN)
+
+enum class RegOp : uint8_t {
+#define PIPS_REGISTER_OPCODE_ENUM(name) name,
+  PIPS_REGISTER_OPCODES(PIPS_REGISTER_OPCODE_ENUM)
+#undef PIPS_REGISTER_OPCODE_ENUM
+};
+
+struct RegInstruction {
+  RegOp op;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+};
+
+static_assert(sizeof(RegInstruction) == 8, "Register instructions should be one word");
+
+// Code for the register backend. The register file holds the input frame, then the
+// constants, then one register per stack slot of the equivalent stack code, so
+// locals keep their stack slot numbers and constants and inputs are read in place.
+template <typename Real = DefaultReal>
+struct RegisterChunk {
+  using Value = pips::Value<Real>;
+
+  std::vector<RegInstruction> code;
+  LineTable lines;
+  // Copied into registers [inputCount, stackBase) before each run.
+  std::vector<Value> constants;
+  uint16_t inputCount = 0;
+  uint16_t stackBase = 0;
+  uint16_t registerCount = 0;
+
+  RegisterChunk() = default;
+  ~RegisterChunk() = default;
+
+  void write(RegInstruction instruction, int line) {
+    lines.add(code.size(), line);
+    code.push_back(instruction);
+  }
+
+  void printRegister(uint16_t reg) const {
+    if (reg < inputCount) {
+      printf(" in%d", reg);
+    } else if (reg < stackBase) {
+      printf(" k%d '", reg - inputCount);
+      printValue(constants[reg - inputCount]);
+      printf("'");
+    } else {
+      printf(" r%d", reg - stackBase);
+    }
+  }
+  int disassembleInstruction(int i) const {
+#define PIPS_REGISTER_OPCODE_NAME(name) "OP_" #name,
+    static const char *const names[] = {PIPS_REGISTER_OPCODES(PIPS_REGISTER_OPCODE_NAME)};
+#undef PIPS_REGISTER_OPCODE_NAME
+    printf("%04d ", i);
+    if ((i > 0) && (lines.lineAt(i) == lines.lineAt(i - 1))) {
+      printf("   | ");
+    } else {
+      printf("%4d ", lines.lineAt(i));
+    }
+    const RegInstruction &in = code[i];
+    printf("%-16s", names[static_cast<int>(in.op)]);
+    switch (in.op) {
+    case RegOp::GET_GLOBAL:
+      printRegister(in.a);
+      printf(" g%d", in.b);
+      break;
+    case RegOp::SET_GLOBAL:
+    case RegOp::DEFINE_GLOBAL:
+      printf(" g%d", in.a);
+      printRegister(in.b);
+      break;
+    case RegOp::JUMP:
+      printf(" -> %d", in.a);
+      break;
+    case RegOp::JUMP_IF_FALSE:
+      printRegister(in.b);
+      printf(" -> %d", in.a);
+      break;
+    case RegOp::PRINT:
+    case RegOp::RETURN:
+      printRegister(in.b);
+      break;
+    case RegOp::NEWLINE:
+      break;
+    case RegOp::LIST:
+      printf(" %d", in.a);
+      break;
+    default:
+      printRegister(in.a);
+      printRegister(in.b);
+      if (in.op >= RegOp::ADD) printRegister(in.c);
+    }
+    printf("\n");
+    return i + 1;
+  }
+  void disassemble(std::string name) const {
+    printf("== %s ==\n", name.c_str());
+    for (int i = 0; i < static_cast<int>(code.size());) {
+      i = disassembleInstruction(i);
+    }
+  }
+};
+
+// Translates the stack code produced by Compiler into register code. The stack is
+// executed symbolically: every stack slot is bound to the register its value
+// currently lives in, so pushing a constant, an input or a local emits nothing and
+// an operator reads its operands straight from where they are. A value is only
+// copied into its slot's register (MOVE) when control flow joins, when a local it
+// still refers to is about to be overwritten, or before LIST. Registers and jump
+// targets are 16-bit, so compile() fails for chunks too large to address.
+template <typename Real = DefaultReal>
+struct RegisterCompiler {
+  using Value = pips::Value<Real>;
+  using Chunk = pips::Chunk<Real>;
+  using RegisterChunk = pips::RegisterChunk<Real>;
+
+  const Chunk *chunk = nullptr;
+  RegisterChunk *out = nullptr;
+
+  // Register holding the value of each live stack slot.
+  ArenaVector<uint16_t> slots;
+  // Stack depth before each instruction of the stack code, -1 where unreachable.
+  ArenaVector<int> depthAt;
+  ArenaVector<uint8_t> isTarget;
+  // Register instruction starting at each jump target of the stack code.
+  ArenaVector<int> labels;
+  // Emitted jumps and the stack code offset they go to.
+  ArenaVector<std::pair<size_t, size_t>> fixups;
+  // Last emitted instruction if it computed the top of the stack, else -1. Its
+  // destination can be redirected to a local that the result is assigned to.
+  int lastResult = -1;
+  int line = 0;
+  uint16_t nilRegister = 0;
+  uint16_t trueRegister = 0;
+  uint16_t falseRegister = 0;
+
+  RegisterCompiler() = default;
+  ~RegisterCompiler() = default;
+
+  // Register operation computing the same result as a stack operator.
+  static RegOp registerOp(uint8_t op) {
+    switch (checkedOp(op)) {
+#define PIPS_REGISTER_OPCODE_MAP(name)                                                   \
+  case OpCode::name:                                                                     \
+    return RegOp::name;
+      PIPS_REGISTER_OPCODE_MAP(NEGATE)
+      PIPS_REGISTER_OPCODE_MAP(UPLUS)
+      PIPS_REGISTER_OPCODE_MAP(NOT)
+      PIPS_REGISTER_OPCODE_MAP(BNOT)
+      PIPS_REGISTER_OPCODE_MAP(EXP)
+      PIPS_REGISTER_OPCODE_MAP(SIN)
+      PIPS_REGISTER_OPCODE_MAP(COS)
+      PIPS_REGISTER_OPCODE_MAP(TAN)
+      PIPS_REGISTER_OPCODE_MAP(ABS)
+      PIPS_REGISTER_OPCODE_MAP(LOG)
+      PIPS_REGISTER_OPCODE_MAP(LOG10)
+      PIPS_REGISTER_OPCODE_MAP(SIGN)
+      PIPS_REGISTER_OPCODE_MAP(SQRT)
+      PIPS_REGISTER_OPCODE_MAP(ACOS)
+      PIPS_REGISTER_OPCODE_MAP(ASIN)
+      PIPS_REGISTER_OPCODE_MAP(ATAN)
+      PIPS_REGISTER_OPCODE_MAP(CEIL)
+      PIPS_REGISTER_OPCODE_MAP(FLOOR)
+      PIPS_REGISTER_OPCODE_MAP(ADD)
+      PIPS_REGISTER_OPCODE_MAP(SUBTRACT)
+      PIPS_REGISTER_OPCODE_MAP(MULTIPLY)
+      PIPS_REGISTER_OPCODE_MAP(DIVIDE)
+      PIPS_REGISTER_OPCODE_MAP(INTDIVIDE)
+      PIPS_REGISTER_OPCODE_MAP(MOD)
+      PIPS_REGISTER_OPCODE_MAP(POW)
+      PIPS_REGISTER_OPCODE_MAP(ATAN2)
+      PIPS_REGISTER_OPCODE_MAP(MIN)
+      PIPS_REGISTER_OPCODE_MAP(MAX)
+      PIPS_REGISTER_OPCODE_MAP(XOR)
+      PIPS_REGISTER_OPCODE_MAP(BOR)
+      PIPS_REGISTER_OPCODE_MAP(BAND)
+      PIPS_REGISTER_OPCODE_MAP(LSHIFT)
+      PIPS_REGISTER_OPCODE_MAP(RSHIFT)
+      PIPS_REGISTER_OPCODE_MAP(EQUAL)
+      PIPS_REGISTER_OPCODE_MAP(GREATER)
+      PIPS_REGISTER_OPCODE_MAP(LESS)
+      PIPS_REGISTER_OPCODE_MAP(NOT_EQUAL)
+      PIPS_REGISTER_OPCODE_MAP(GREATER_EQUAL)
+      PIPS_REGISTER_OPCODE_MAP(LESS_EQUAL)
+#undef PIPS_REGISTER_OPCODE_MAP
+    default:
+      return RegOp::MOVE;
+    }
+  }
+
+  // Record the stack depth before every reachable instruction and mark jump targets.
+  // Returns the largest depth reached.
+  int computeDepths() {
+    const auto &code = chunk->code;
+    depthAt.assign(code.size(), -1);
+    isTarget.assign(code.size(), 0);
+    int maxDepth = 0;
+    ArenaVector<size_t> work;
+    auto reach = [&](size_t i, int depth) {
+      if (i >= code.size() || depthAt[i] >= 0) return;
+      depthAt[i] = depth;
+      work.push_back(i);
+    };
+    reach(0, 0);
+    while (!work.empty()) {
+      const size_t i = work.back();
+      work.pop_back();
+      const uint8_t op = code[i];
+      const int depth = depthAt[i] + stackEffect(op);
+      maxDepth = std::max(maxDepth, depth);
+      if (isJumpOp(op)) {
+        const size_t target = jumpTarget(code, i);
+        isTarget[target] = 1;
+        reach(target, depth);
+      }
+      if (narrowOp(op) != OpCode::JUMP && narrowOp(op) != OpCode::LOOP &&
+          op != OpCode::RETURN) {
+        reach(i + instructionLength(op), depth);
+      }
+    }
+    return maxDepth;
+  }
+
+  uint16_t slotRegister(size_t slot) const { return static_cast<uint16_t>(out->stackBase + slot); }
+  size_t depth() const { return slots.size(); }
+  uint16_t top() const { return slots.back(); }
+
+  void emit(RegOp op, uint16_t a, uint16_t b = 0, uint16_t c = 0) {
+    out->write(RegInstruction{op, a, b, c}, line);
+    lastResult = -1;
+  }
+  // Copy a slot's value into the slot's own register.
+  void materialize(size_t slot) {
+    if (slots[slot] == slotRegister(slot)) return;
+    emit(RegOp::MOVE, slotRegister(slot), slots[slot]);
+    slots[slot] = slotRegister(slot);
+  }
+  // Bring every slot into its own register, as expected at jumps and jump targets.
+  void flush() {
+    for (size_t slot = 0; slot < depth(); slot++) {
+      materialize(slot);
+    }
+  }
+  // Replace the top `operands` slots with the result of `op`, computed into the
+  // register of the lowest of them.
+  void operation(RegOp op, size_t operands) {
+    const size_t dst = depth() - operands;
+    const uint16_t b = slots[dst];
+    const uint16_t c = (operands == 2) ? slots[dst + 1] : 0;
+    emit(op, slotRegister(dst), b, c);
+    slots.resize(dst + 1);
+    slots[dst] = slotRegister(dst);
+    lastResult = static_cast<int>(out->code.size()) - 1;
+  }
+  void setLocal(size_t local) {
+    const uint16_t reg = slotRegister(local);
+    // Slots still reading the local's old value need their own copy first.
+    bool copied = false;
+    for (size_t slot = 0; slot < depth(); slot++) {
+      if (slot != local && slots[slot] == reg) {
+        materialize(slot);
+        copied = true;
+      }
+    }
+    const size_t value = depth() - 1;
+    if (!copied && lastResult >= 0 && slots[value] == slotRegister(value) &&
+        out->code[lastResult].a == slots[value]) {
+      // Compute the value straight into the local.
+      out->code[lastResult].a = reg;
+      slots[value] = reg;
+    } else if (slots[value] != reg) {
+      emit(RegOp::MOVE, reg, slots[value]);
+    }
+    slots[local] = reg;
+    lastResult = -1;
+  }
+
+  bool compile(const Chunk &chunk_, size_t inputCount, RegisterChunk &out_) {
+    chunk = &chunk_;
+    out = &out_;
+    const auto &code = chunk->code;
+    const int maxDepth = computeDepths();
+
+    out->code.clear();
+    out->lines.clear();
+    out->constants.assign(chunk->constants.begin(), chunk->constants.end());
+    out->inputCount = static_cast<uint16_t>(inputCount);
+    const size_t constantBase = inputCount;
+    nilRegister = static_cast<uint16_t>(constantBase + out->constants.size());
+    out->constants.push_back(NIL_VAL);
+    trueRegister = static_cast<uint16_t>(constantBase + out->constants.size());
+    out->constants.push_back(BOOL_VAL(true));
+    falseRegister = static_cast<uint16_t>(constantBase + out->constants.size());
+    out->constants.push_back(BOOL_VAL(false));
+    const size_t registers = constantBase + out->constants.size() + maxDepth;
+    if (registers > UINT16_MAX) return false;
+    out->stackBase = static_cast<uint16_t>(constantBase + out->constants.size());
+    out->registerCount = static_cast<uint16_t>(registers);
+
+    slots.clear();
+    labels.assign(code.size(), -1);
+    fixups.clear();
+    lastResult = -1;
+    bool reachable = false;
+    for (size_t i = 0; i < code.size(); i += instructionLength(code[i])) {
+      if (depthAt[i] < 0) continue;
+      line = chunk->lineAt(i);
+      if (isTarget[i]) {
+        if (reachable) flush();
+        slots.resize(depthAt[i]);
+        for (size_t slot = 0; slot < depth(); slot++) {
+          slots[slot] = slotRegister(slot);
+        }
+        labels[i] = static_cast<int>(out->code.size());
+        lastResult = -1;
+      }
+      reachable = true;
+      const uint8_t op = code[i];
+      switch (narrowOp(op)) {
+      case OpCode::CONSTANT:
+        slots.push_back(static_cast<uint16_t>(constantBase + operandAt(code, i)));
+        break;
+      case OpCode::NIL:
+        slots.push_back(nilRegister);
+        break;
+      case OpCode::TRUE:
+        slots.push_back(trueRegister);
+        break;
+      case OpCode::FALSE:
+        slots.push_back(falseRegister);
+        break;
+      case OpCode::GET_INPUT:
+        slots.push_back(code[i + 1]);
+        break;
+      case OpCode::GET_LOCAL:
+        slots.push_back(slots[operandAt(code, i)]);
+        break;
+      case OpCode::SET_LOCAL:
+        setLocal(operandAt(code, i));
+        break;
+      case OpCode::GET_GLOBAL:
+        slots.push_back(slotRegister(depth()));
+        emit(RegOp::GET_GLOBAL, top(), static_cast<uint16_t>((code[i + 1] << 8) | code[i + 2]));
+        lastResult = static_cast<int>(out->code.size()) - 1;
+        break;
+      case OpCode::SET_GLOBAL:
+        emit(RegOp::SET_GLOBAL, static_cast<uint16_t>((code[i + 1] << 8) | code[i + 2]), top());
+        break;
+      case OpCode::DEFINE_GLOBAL:
+        emit(RegOp::DEFINE_GLOBAL, static_cast<uint16_t>((code[i + 1] << 8) | code[i + 2]),
+             top());
+        slots.pop_back();
+        break;
+      case OpCode::POP:
+        slots.pop_back();
+        lastResult = -1;
+        break;
+      case OpCode::PRINT:
+        emit(RegOp::PRINT, 0, top());
+        slots.pop_back();
+        break;
+      case OpCode::NEWLINE:
+        emit(RegOp::NEWLINE, 0);
+        break;
+      case OpCode::LIST:
+        flush();
+        emit(RegOp::LIST, static_cast<uint16_t>(depth()));
+        break;
+      // Superinstructions are lowered like the sequences they replace.
+      case OpCode::ADD_LOCAL_CONST:
+        slots.push_back(slots[code[i + 1]]);
+        slots.push_back(static_cast<uint16_t>(constantBase + code[i + 2]));
+        operation(RegOp::ADD, 2);
+        break;
+      case OpCode::MULTIPLY_LOCALS:
+        slots.push_back(slots[code[i + 1]]);
+        slots.push_back(slots[code[i + 2]]);
+        operation(RegOp::MULTIPLY, 2);
+        break;
+      case OpCode::SET_LOCAL_CONST:
+        slots.push_back(static_cast<uint16_t>(constantBase + code[i + 2]));
+        setLocal(code[i + 1]);
+        break;
+      case OpCode::LESS_JUMP_IF_FALSE:
+        operation(RegOp::LESS, 2);
+        flush();
+        fixups.emplace_back(out->code.size(), jumpTarget(code, i));
+        emit(RegOp::JUMP_IF_FALSE, 0, top());
+        break;
+      case OpCode::JUMP_IF_FALSE:
+        flush();
+        fixups.emplace_back(out->code.size(), jumpTarget(code, i));
+        emit(RegOp::JUMP_IF_FALSE, 0, top());
+        break;
+      case OpCode::JUMP:
+      case OpCode::LOOP:
+        flush();
+        fixups.emplace_back(out->code.size(), jumpTarget(code, i));
+        emit(RegOp::JUMP, 0);
+        reachable = false;
+        break;
+      case OpCode::RETURN:
+        emit(RegOp::RETURN, 0, (depth() > 0) ? top() : nilRegister);
+        reachable = false;
+        break;
+      default:
+        operation(registerOp(op), 1 - stackEffect(op));
+      }
+    }
+    if (out->code.size() > UINT16_MAX) return false;
+    for (const auto &[instruction, target] : fixups) {
+      out->code[instruction].a = static_cast<uint16_t>(labels[target]);
+    }
+    return true;
+  }
+};
+
+} // namespace pips
+#endif // PIPS_REGISTER_HPP_
@@ -0,0 +1,254 @@
+#ifndef PIPS_SIMD_HPP_
+#define PIPS_SIMD_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "math.hpp"
+
+#if !defined(PIPS_NO_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PIPS_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define PIPS_SIMD_X86 0
+#endif
+
+namespace pips {
+namespace simd {
+
+// Array versions of the math opcodes on doubles, used by BatchEvaluator. The best
+// instruction set is picked once at runtime; arguments a kernel cannot handle
+// exactly (special values, huge arguments, multiples of pi/2 for the trigonometric
+// functions) are passed on to the same scalar function VM::run uses, so special
+// values such as sin(pi) == 0 are identical. Other results of exp, log, sin, cos,
+// tan and atan2 are within 3 ulp of the C library; sqrt, floor, ceil,
+// min and max are exact. pow always runs the scalar function.
+enum class Isa : uint8_t { SCALAR, AVX2, AVX512 };
+
+using UnaryKernel = void (*)(const double *a, double *r, size_t n);
+using BinaryKernel = void (*)(const double *a, const double *b, double *r, size_t n);
+
+struct Kernels {
+  Isa isa;
+  UnaryKernel exp, sin, cos, tan, sqrt, log, floor, ceil;
+  BinaryKernel pow, atan2, min, max;
+};
+
+namespace scalar {
+
+inline double exp(double x) { return std::exp(x); }
+inline double sin(double x) { return pips::sin(x); }
+inline double cos(double x) { return pips::cos(x); }
+inline double tan(double x) { return pips::tan(x); }
+inline double sqrt(double x) { return std::sqrt(x); }
+inline double log(double x) { return std::log(x); }
+inline double floor(double x) { return std::floor(x); }
+inline double ceil(double x) { return std::ceil(x); }
+inline double pow(double a, double b) { return std::pow(a, b); }
+inline double atan2(double a, double b) { return std::atan2(a, b); }
+inline double min(double a, double b) { return std::min(a, b); }
+inline double max(double a, double b) { return std::max(a, b); }
+
+template <double (*F)(double)>
+void unaryArray(const double *a, double *r, size_t n) {
+  for (size_t i = 0; i < n; i++) r[i] = F(a[i]);
+}
+template <double (*F)(double, double)>
+void binaryArray(const double *a, const double *b, double *r, size_t n) {
+  for (size_t i = 0; i < n; i++) r[i] = F(a[i], b[i]);
+}
+
+} // namespace scalar
+
+#if PIPS_SIMD_X86
+
+namespace avx2 {
+
+#define PIPS_SIMD_TARGET __attribute__((target("avx2,fma")))
+
+using V = __m256d;
+using M = __m256d;
+constexpr size_t WIDTH = 4;
+
+PIPS_SIMD_TARGET inline V load(const double *p) { return _mm256_loadu_pd(p); }
+PIPS_SIMD_TARGET inline void store(double *p, V x) { _mm256_storeu_pd(p, x); }
+PIPS_SIMD_TARGET inline V set1(double x) { return _mm256_set1_pd(x); }
+PIPS_SIMD_TARGET inline V add(V a, V b) { return _mm256_add_pd(a, b); }
+PIPS_SIMD_TARGET inline V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+PIPS_SIMD_TARGET inline V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+PIPS_SIMD_TARGET inline V div(V a, V b) { return _mm256_div_pd(a, b); }
+PIPS_SIMD_TARGET inline V fmadd(V a, V b, V c) { return _mm256_fmadd_pd(a, b, c); }
+PIPS_SIMD_TARGET inline V fnmadd(V a, V b, V c) { return _mm256_fnmadd_pd(a, b, c); }
+PIPS_SIMD_TARGET inline V sqrt(V x) { return _mm256_sqrt_pd(x); }
+PIPS_SIMD_TARGET inline V minFirstIfLess(V a, V b) { return _mm256_min_pd(a, b); }
+PIPS_SIMD_TARGET inline V maxFirstIfGreater(V a, V b) { return _mm256_max_pd(a, b); }
+PIPS_SIMD_TARGET inline V roundNearest(V x) {
+  return _mm256_round_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+PIPS_SIMD_TARGET inline V floor(V x) {
+  return _mm256_round_pd(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+}
+PIPS_SIMD_TARGET inline V ceil(V x) {
+  return _mm256_round_pd(x, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+}
+PIPS_SIMD_TARGET inline V band(V a, V b) { return _mm256_and_pd(a, b); }
+PIPS_SIMD_TARGET inline V bor(V a, V b) { return _mm256_or_pd(a, b); }
+PIPS_SIMD_TARGET inline V bxor(V a, V b) { return _mm256_xor_pd(a, b); }
+PIPS_SIMD_TARGET inline V bandnot(V a, V b) { return _mm256_andnot_pd(a, b); }
+PIPS_SIMD_TARGET inline V mantissaMask() {
+  return _mm256_castsi256_pd(_mm256_set1_epi64x(0x000fffffffffffffLL));
+}
+PIPS_SIMD_TARGET inline V shl52(V x) {
+  return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_castpd_si256(x), 52));
+}
+PIPS_SIMD_TARGET inline V shr52(V x) {
+  return _mm256_castsi256_pd(_mm256_srli_epi64(_mm256_castpd_si256(x), 52));
+}
+PIPS_SIMD_TARGET inline M lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+PIPS_SIMD_TARGET inline M gt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+PIPS_SIMD_TARGET inline M ge(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+PIPS_SIMD_TARGET inline M eq(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+PIPS_SIMD_TARGET inline M nlt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_NLT_UQ); }
+PIPS_SIMD_TARGET inline M nle(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_NLE_UQ); }
+PIPS_SIMD_TARGET inline M nge(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_NGE_UQ); }
+PIPS_SIMD_TARGET inline M mor(M a, M b) { return _mm256_or_pd(a, b); }
+PIPS_SIMD_TARGET inline M none() { return _mm256_setzero_pd(); }
+PIPS_SIMD_TARGET inline V select(M m, V a, V b) { return _mm256_blendv_pd(b, a, m); }
+PIPS_SIMD_TARGET inline unsigned bits(M m) { return static_cast<unsigned>(_mm256_movemask_pd(m)); }
+
+#include "simd_kernels.inl"
+
+#undef PIPS_SIMD_TARGET
+
+} // namespace avx2
+
+// GCC 12 warns about the deliberately undefined pass-through operand inside some
+// AVX-512 intrinsics once they are inlined.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace avx512 {
+
+#define PIPS_SIMD_TARGET __attribute__((target("avx512f")))
+
+using V = __m512d;
+using M = __mmask8;
+constexpr size_t WIDTH = 8;
+
+PIPS_SIMD_TARGET inline V load(const double *p) { return _mm512_loadu_pd(p); }
+PIPS_SIMD_TARGET inline void store(double *p, V x) { _mm512_storeu_pd(p, x); }
+PIPS_SIMD_TARGET inline V set1(double x) { return _mm512_set1_pd(x); }
+PIPS_SIMD_TARGET inline V add(V a, V b) { return _mm512_add_pd(a, b); }
+PIPS_SIMD_TARGET inline V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+PIPS_SIMD_TARGET inline V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+PIPS_SIMD_TARGET inline V div(V a, V b) { return _mm512_div_pd(a, b); }
+PIPS_SIMD_TARGET inline V fmadd(V a, V b, V c) { return _mm512_fmadd_pd(a, b, c); }
+PIPS_SIMD_TARGET inline V fnmadd(V a, V b, V c) { return _mm512_fnmadd_pd(a, b, c); }
+PIPS_SIMD_TARGET inline V sqrt(V x) { return _mm512_sqrt_pd(x); }
+PIPS_SIMD_TARGET inline V minFirstIfLess(V a, V b) { return _mm512_min_pd(a, b); }
+PIPS_SIMD_TARGET inline V maxFirstIfGreater(V a, V b) { return _mm512_max_pd(a, b); }
+PIPS_SIMD_TARGET inline V roundNearest(V x) {
+  return _mm512_roundscale_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+PIPS_SIMD_TARGET inline V floor(V x) {
+  return _mm512_roundscale_pd(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+}
+PIPS_SIMD_TARGET inline V ceil(V x) {
+  return _mm512_roundscale_pd(x, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+}
+// AVX-512F has no floating point logic instructions, so use the integer ones.
+PIPS_SIMD_TARGET inline V band(V a, V b) {
+  return _mm512_castsi512_pd(_mm512_and_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b)));
+}
+PIPS_SIMD_TARGET inline V bor(V a, V b) {
+  return _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b)));
+}
+PIPS_SIMD_TARGET inline V bxor(V a, V b) {
+  return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b)));
+}
+PIPS_SIMD_TARGET inline V bandnot(V a, V b) {
+  return _mm512_castsi512_pd(_mm512_andnot_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b)));
+}
+PIPS_SIMD_TARGET inline V mantissaMask() {
+  return _mm512_castsi512_pd(_mm512_set1_epi64(0x000fffffffffffffLL));
+}
+PIPS_SIMD_TARGET inline V shl52(V x) {
+  return _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_castpd_si512(x), 52));
+}
+PIPS_SIMD_TARGET inline V shr52(V x) {
+  return _mm512_castsi512_pd(_mm512_srli_epi64(_mm512_castpd_si512(x), 52));
+}
+PIPS_SIMD_TARGET inline M lt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+PIPS_SIMD_TARGET inline M gt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+PIPS_SIMD_TARGET inline M ge(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+PIPS_SIMD_TARGET inline M eq(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+PIPS_SIMD_TARGET inline M nlt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_NLT_UQ); }
+PIPS_SIMD_TARGET inline M nle(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_NLE_UQ); }
+PIPS_SIMD_TARGET inline M nge(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_NGE_UQ); }
+PIPS_SIMD_TARGET inline M mor(M a, M b) { return static_cast<M>(a | b); }
+PIPS_SIMD_TARGET inline M none() { return 0; }
+PIPS_SIMD_TARGET inline V select(M m, V a, V b) { return _mm512_mask_blend_pd(m, b, a); }
+PIPS_SIMD_TARGET inline unsigned bits(M m) { return m; }
+
+#include "simd_kernels.inl"
+
+#undef PIPS_SIMD_TARGET
+
+} // namespace avx512
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // PIPS_SIMD_X86
+
+// Most capable instruction set supported by both the build and the running CPU.
+inline Isa bestIsa() {
+#if PIPS_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return Isa::AVX512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return Isa::AVX2;
+#endif
+  return Isa::SCALAR;
+}
+
+// Kernels for `isa`, or for the best supported instruction set below it.
+inline const Kernels &kernels(Isa isa) {
+  static const Kernels scalarKernels{
+      Isa::SCALAR,
+      scalar::unaryArray<scalar::exp>,   scalar::unaryArray<scalar::sin>,
+      scalar::unaryArray<scalar::cos>,   scalar::unaryArray<scalar::tan>,
+      scalar::unaryArray<scalar::sqrt>,  scalar::unaryArray<scalar::log>,
+      scalar::unaryArray<scalar::floor>, scalar::unaryArray<scalar::ceil>,
+      scalar::binaryArray<scalar::pow>,  scalar::binaryArray<scalar::atan2>,
+      scalar::binaryArray<scalar::min>,  scalar::binaryArray<scalar::max>};
+#if PIPS_SIMD_X86
+  static const Kernels avx2Kernels{
+      Isa::AVX2,    avx2::exp,  avx2::sin,   avx2::cos,
+      avx2::tan,    avx2::sqrt, avx2::log,   avx2::floor,
+      avx2::ceil,   scalar::binaryArray<scalar::pow>,
+      avx2::atan2,  avx2::min,  avx2::max};
+  static const Kernels avx512Kernels{
+      Isa::AVX512,  avx512::exp,  avx512::sin,   avx512::cos,
+      avx512::tan,  avx512::sqrt, avx512::log,   avx512::floor,
+      avx512::ceil, scalar::binaryArray<scalar::pow>,
+      avx512::atan2, avx512::min, avx512::max};
+  static const Isa best = bestIsa();
+  const Isa chosen = std::min(isa, best);
+  if (chosen == Isa::AVX512) return avx512Kernels;
+  if (chosen == Isa::AVX2) return avx2Kernels;
+#else
+  (void)isa;
+#endif
+  return scalarKernels;
+}
+
+inline const Kernels &kernels() { return kernels(Isa::AVX512); }
+
+} // namespace simd
+} // namespace pips
+#endif // PIPS_SIMD_HPP_
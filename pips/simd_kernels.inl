@@ -0,0 +1,300 @@
+// Vector math kernels shared by the AVX2 and AVX-512 code paths of simd.hpp.
+//
+// This file has no include guard: simd.hpp includes it once per instruction set,
+// inside a namespace that defines the vector type V, the mask type M, the lane
+// count WIDTH, the primitive operations and PIPS_SIMD_TARGET. Every kernel returns
+// its lanes and sets `fallback` to the lanes the scalar function must recompute:
+// non-finite or out-of-range arguments, and arguments so close to a multiple of
+// pi/2 that pips::sin, cos and tan may return one of their exact special values.
+
+PIPS_SIMD_TARGET inline V vneg(V x) { return bxor(x, set1(-0.0)); }
+PIPS_SIMD_TARGET inline V vabs(V x) { return bandnot(set1(-0.0), x); }
+
+// 2^n for integral n in [-1022, 1023].
+PIPS_SIMD_TARGET inline V vscale(V n) {
+  return shl52(add(n, set1(4503599627370496.0 + 1023.0)));
+}
+
+PIPS_SIMD_TARGET inline V vexp(V x, M &fallback) {
+  // Below -708 the result is subnormal, above 708 it may overflow.
+  fallback = nle(vabs(x), set1(708.0));
+  const V k = roundNearest(mul(x, set1(1.44269504088896338700e+00)));
+  V r = fnmadd(k, set1(6.93147180369123816490e-01), x);
+  r = fnmadd(k, set1(1.90821492927058770002e-10), r);
+  // Taylor series of exp(r) for |r| <= ln(2)/2, truncated after r^13.
+  V p = set1(1.0 / 6227020800.0);
+  p = fmadd(p, r, set1(1.0 / 479001600.0));
+  p = fmadd(p, r, set1(1.0 / 39916800.0));
+  p = fmadd(p, r, set1(1.0 / 3628800.0));
+  p = fmadd(p, r, set1(1.0 / 362880.0));
+  p = fmadd(p, r, set1(1.0 / 40320.0));
+  p = fmadd(p, r, set1(1.0 / 5040.0));
+  p = fmadd(p, r, set1(1.0 / 720.0));
+  p = fmadd(p, r, set1(1.0 / 120.0));
+  p = fmadd(p, r, set1(1.0 / 24.0));
+  p = fmadd(p, r, set1(1.0 / 6.0));
+  p = fmadd(p, r, set1(0.5));
+  p = fmadd(p, r, set1(1.0));
+  p = fmadd(p, r, set1(1.0));
+  return mul(p, vscale(k));
+}
+
+PIPS_SIMD_TARGET inline V vlog(V x, M &fallback) {
+  // Zero, negative, subnormal, infinite and NaN arguments go to std::log.
+  fallback = mor(nge(x, set1(2.2250738585072014e-308)), eq(x, set1(HUGE_VAL)));
+  // x = 2^e * m with m in [sqrt(2)/2, sqrt(2)).
+  V e = sub(bor(shr52(x), set1(4503599627370496.0)), set1(4503599627370496.0 + 1023.0));
+  V m = bor(band(x, mantissaMask()), set1(1.0));
+  const M high = gt(m, set1(1.41421356237309504880));
+  m = select(high, mul(m, set1(0.5)), m);
+  e = select(high, add(e, set1(1.0)), e);
+  // log(1+f) as in fdlibm's __ieee754_log.
+  const V f = sub(m, set1(1.0));
+  const V hfsq = mul(set1(0.5), mul(f, f));
+  const V s = div(f, add(set1(2.0), f));
+  const V z = mul(s, s);
+  const V w = mul(z, z);
+  const V t1 = mul(w, fmadd(w, fmadd(w, set1(1.531383769920937332e-01), set1(2.222219843214978396e-01)),
+                            set1(3.999999999940941908e-01)));
+  const V t2 = mul(z, fmadd(w, fmadd(w, fmadd(w, set1(1.479819860511658591e-01),
+                                              set1(1.818357216161805012e-01)),
+                                     set1(2.857142874366239149e-01)),
+                            set1(6.666666666666735130e-01)));
+  const V R = add(t2, t1);
+  const V lo = fmadd(s, add(hfsq, R), mul(e, set1(1.90821492927058770002e-10)));
+  return sub(mul(e, set1(6.93147180369123816490e-01)), sub(sub(hfsq, lo), f));
+}
+
+// Reduces x to y in [-pi/4, pi/4] with x = y + q*pi/2 (mod 2*pi), q in {0, 1, 2, 3}.
+// pi/2 is split into three doubles so that every fused step rounds only its result.
+PIPS_SIMD_TARGET inline V vreduce(V x, V &q, M &fallback) {
+  const V k = roundNearest(mul(x, set1(6.36619772367581382433e-01)));
+  V y = fnmadd(k, set1(0x1.921fb54442d18p+0), x);
+  y = fnmadd(k, set1(0x1.1a62633145c07p-54), y);
+  y = fnmadd(k, set1(-0x1.f1976b7ed8fbcp-110), y);
+  q = sub(k, mul(set1(4.0), floor(mul(k, set1(0.25)))));
+  // pips::sin, cos and tan test the argument reduced by fmod with the double
+  // nearest 2*pi against an epsilon of 100 ulp(1). Up to |x| = 2^20 that differs
+  // from y by well under 1e-9, so every lane they may special-case falls back.
+  fallback = mor(nle(vabs(x), set1(1048576.0)), lt(vabs(y), set1(1e-9)));
+  return y;
+}
+
+PIPS_SIMD_TARGET inline V vsinPoly(V y) {
+  const V z = mul(y, y);
+  V p = fmadd(z, set1(1.58969099521155010221e-10), set1(-2.50507602534068634195e-08));
+  p = fmadd(z, p, set1(2.75573137070700676789e-06));
+  p = fmadd(z, p, set1(-1.98412698298579493134e-04));
+  p = fmadd(z, p, set1(8.33333333332248946124e-03));
+  p = fmadd(z, p, set1(-1.66666666666666324348e-01));
+  return fmadd(mul(z, y), p, y);
+}
+
+PIPS_SIMD_TARGET inline V vcosPoly(V y) {
+  const V z = mul(y, y);
+  V p = fmadd(z, set1(-1.13596475577881948265e-11), set1(2.08757232129817482790e-09));
+  p = fmadd(z, p, set1(-2.75573143513906633035e-07));
+  p = fmadd(z, p, set1(2.48015872894767294178e-05));
+  p = fmadd(z, p, set1(-1.38888888888741095749e-03));
+  p = fmadd(z, p, set1(4.16666666666666019037e-02));
+  const V r = mul(z, p);
+  const V hz = mul(set1(0.5), z);
+  const V w = sub(set1(1.0), hz);
+  return add(w, fmadd(z, r, sub(sub(set1(1.0), w), hz)));
+}
+
+PIPS_SIMD_TARGET inline V vsin(V x, M &fallback) {
+  V q;
+  const V y = vreduce(x, q, fallback);
+  const M odd = mor(eq(q, set1(1.0)), eq(q, set1(3.0)));
+  const V r = select(odd, vcosPoly(y), vsinPoly(y));
+  return select(ge(q, set1(2.0)), vneg(r), r);
+}
+
+PIPS_SIMD_TARGET inline V vcos(V x, M &fallback) {
+  V q;
+  const V y = vreduce(x, q, fallback);
+  const M odd = mor(eq(q, set1(1.0)), eq(q, set1(3.0)));
+  const V r = select(odd, vsinPoly(y), vcosPoly(y));
+  return select(mor(eq(q, set1(1.0)), eq(q, set1(2.0))), vneg(r), r);
+}
+
+PIPS_SIMD_TARGET inline V vtan(V x, M &fallback) {
+  V q;
+  const V y = vreduce(x, q, fallback);
+  const V s = vsinPoly(y);
+  const V c = vcosPoly(y);
+  const M odd = mor(eq(q, set1(1.0)), eq(q, set1(3.0)));
+  return select(odd, vneg(div(c, s)), div(s, c));
+}
+
+PIPS_SIMD_TARGET inline V vatan2(V y, V x, M &fallback) {
+  const V ax = vabs(x);
+  const V ay = vabs(y);
+  // Zeros, infinities and NaNs carry the signed special cases of std::atan2.
+  fallback = mor(mor(eq(ax, set1(0.0)), eq(ay, set1(0.0))),
+                 mor(nlt(ax, set1(HUGE_VAL)), nlt(ay, set1(HUGE_VAL))));
+  const M swap = gt(ay, ax);
+  const V num = select(swap, ax, ay);
+  const V den = select(swap, ay, ax);
+  // atan(num/den) with num/den in [0, 1], after Cephes: above 0.66 the argument is
+  // mapped to (t-1)/(t+1) and pi/4 added back.
+  const M upper = gt(num, mul(set1(0.66), den));
+  const V t = select(upper, div(sub(num, den), add(num, den)), div(num, den));
+  const V z = mul(t, t);
+  V p = fmadd(z, set1(-8.750608600031904122785e-01), set1(-1.615753718733365076637e+01));
+  p = fmadd(z, p, set1(-7.500855792314704667340e+01));
+  p = fmadd(z, p, set1(-1.228866684490136173410e+02));
+  p = fmadd(z, p, set1(-6.485021904942025371773e+01));
+  V d = add(z, set1(2.485846490142306297962e+01));
+  d = fmadd(z, d, set1(1.650270098316988542046e+02));
+  d = fmadd(z, d, set1(4.328810604912902668951e+02));
+  d = fmadd(z, d, set1(4.853903996359136964868e+02));
+  d = fmadd(z, d, set1(1.945506571482613964425e+02));
+  const V a = fmadd(t, div(mul(z, p), d), t);
+  // result = hi + (a + lo), negated for swapped and left half-plane lanes, with
+  // pi/2 = PIO2 + MOREBITS.
+  const V PIO2 = set1(0x1.921fb54442d18p+0);
+  const V PIO4 = set1(0x1.921fb54442d18p-1);
+  const V MOREBITS = set1(0x1.1a62633145c07p-54);
+  const V HALF_MOREBITS = set1(0x1.1a62633145c07p-55);
+  V hi = select(upper, PIO4, select(swap, PIO2, set1(0.0)));
+  V lo = select(upper, HALF_MOREBITS, select(swap, MOREBITS, set1(0.0)));
+  V sa = select(swap, vneg(a), a);
+  const M left = lt(x, set1(0.0));
+  const V PI = set1(0x1.921fb54442d18p+1);
+  const V leftHi = sub(PI, hi);
+  const V leftLo = add(sub(add(MOREBITS, MOREBITS), lo), sub(sub(PI, leftHi), hi));
+  hi = select(left, leftHi, hi);
+  lo = select(left, leftLo, lo);
+  sa = select(left, vneg(sa), sa);
+  const V result = add(hi, add(sa, lo));
+  return bor(result, band(y, set1(-0.0)));
+}
+
+PIPS_SIMD_TARGET inline V vsqrt(V x, M &fallback) {
+  fallback = none();
+  return sqrt(x);
+}
+PIPS_SIMD_TARGET inline V vfloor(V x, M &fallback) {
+  fallback = none();
+  return floor(x);
+}
+PIPS_SIMD_TARGET inline V vceil(V x, M &fallback) {
+  fallback = none();
+  return ceil(x);
+}
+// std::min(a, b) is (b < a) ? b : a and std::max(a, b) is (a < b) ? b : a. The
+// hardware min and max return their second operand when the comparison fails,
+// so swapping the operands reproduces std:: for NaNs and signed zeros.
+PIPS_SIMD_TARGET inline V vmin(V a, V b, M &fallback) {
+  fallback = none();
+  return minFirstIfLess(b, a);
+}
+PIPS_SIMD_TARGET inline V vmax(V a, V b, M &fallback) {
+  fallback = none();
+  return maxFirstIfGreater(b, a);
+}
+
+// Array drivers. The tail of an array is padded to a full vector so that every
+// element goes through the same kernel.
+template <V (*KERNEL)(V, M &)>
+PIPS_SIMD_TARGET inline void unaryArray(const double *a, double *r, size_t n,
+                                        double (*scalar)(double)) {
+  double in[WIDTH];
+  double out[WIDTH];
+  for (size_t i = 0; i < n; i += WIDTH) {
+    const size_t count = (n - i < WIDTH) ? n - i : WIDTH;
+    V x;
+    if (count == WIDTH) {
+      x = load(a + i);
+    } else {
+      for (size_t k = 0; k < WIDTH; k++) in[k] = (k < count) ? a[i + k] : 1.0;
+      x = load(in);
+    }
+    M fallback;
+    const V y = KERNEL(x, fallback);
+    const unsigned lanes = bits(fallback);
+    if (count == WIDTH && lanes == 0) {
+      store(r + i, y);
+      continue;
+    }
+    // r may alias a, so keep the arguments before writing any result.
+    store(in, x);
+    store(out, y);
+    for (size_t k = 0; k < count; k++) {
+      r[i + k] = ((lanes >> k) & 1u) ? scalar(in[k]) : out[k];
+    }
+  }
+}
+
+template <V (*KERNEL)(V, V, M &)>
+PIPS_SIMD_TARGET inline void binaryArray(const double *a, const double *b, double *r, size_t n,
+                                         double (*scalar)(double, double)) {
+  double inA[WIDTH];
+  double inB[WIDTH];
+  double out[WIDTH];
+  for (size_t i = 0; i < n; i += WIDTH) {
+    const size_t count = (n - i < WIDTH) ? n - i : WIDTH;
+    V x;
+    V y;
+    if (count == WIDTH) {
+      x = load(a + i);
+      y = load(b + i);
+    } else {
+      for (size_t k = 0; k < WIDTH; k++) {
+        inA[k] = (k < count) ? a[i + k] : 1.0;
+        inB[k] = (k < count) ? b[i + k] : 1.0;
+      }
+      x = load(inA);
+      y = load(inB);
+    }
+    M fallback;
+    const V z = KERNEL(x, y, fallback);
+    const unsigned lanes = bits(fallback);
+    if (count == WIDTH && lanes == 0) {
+      store(r + i, z);
+      continue;
+    }
+    store(inA, x);
+    store(inB, y);
+    store(out, z);
+    for (size_t k = 0; k < count; k++) {
+      r[i + k] = ((lanes >> k) & 1u) ? scalar(inA[k], inB[k]) : out[k];
+    }
+  }
+}
+
+PIPS_SIMD_TARGET inline void exp(const double *a, double *r, size_t n) {
+  unaryArray<vexp>(a, r, n, scalar::exp);
+}
+PIPS_SIMD_TARGET inline void sin(const double *a, double *r, size_t n) {
+  unaryArray<vsin>(a, r, n, scalar::sin);
+}
+PIPS_SIMD_TARGET inline void cos(const double *a, double *r, size_t n) {
+  unaryArray<vcos>(a, r, n, scalar::cos);
+}
+PIPS_SIMD_TARGET inline void tan(const double *a, double *r, size_t n) {
+  unaryArray<vtan>(a, r, n, scalar::tan);
+}
+PIPS_SIMD_TARGET inline void sqrt(const double *a, double *r, size_t n) {
+  unaryArray<vsqrt>(a, r, n, scalar::sqrt);
+}
+PIPS_SIMD_TARGET inline void log(const double *a, double *r, size_t n) {
+  unaryArray<vlog>(a, r, n, scalar::log);
+}
+PIPS_SIMD_TARGET inline void floor(const double *a, double *r, size_t n) {
+  unaryArray<vfloor>(a, r, n, scalar::floor);
+}
+PIPS_SIMD_TARGET inline void ceil(const double *a, double *r, size_t n) {
+  unaryArray<vceil>(a, r, n, scalar::ceil);
+}
+PIPS_SIMD_TARGET inline void atan2(const double *a, const double *b, double *r, size_t n) {
+  binaryArray<vatan2>(a, b, r, n, scalar::atan2);
+}
+PIPS_SIMD_TARGET inline void min(const double *a, const double *b, double *r, size_t n) {
+  binaryArray<vmin>(a, b, r, n, scalar::min);
+}
+PIPS_SIMD_TARGET inline void max(const double *a, const double *b, double *r, size_t n) {
+  binaryArray<vmax>(a, b, r, n, scalar::max);
+}
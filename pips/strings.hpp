@@ -0,0 +1,328 @@
+#ifndef PIPS_STRINGS_HPP_
+#define PIPS_STRINGS_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+
+namespace pips {
+
+// Length and hash stored in front of every string, and the id of the StringPool
+// that interned it (0 for temporary strings). The handle of an interned string
+// points at its characters, which are NUL terminated; the handle of a temporary
+// string points at a Rope.
+struct StringHeader {
+  size_t length;
+  uint32_t hash;
+  uint32_t pool;
+};
+
+// A temporary string a + b, made by TemporaryStrings::concat. Its characters are put
+// together on first use, in the arena the rope was allocated from.
+struct Rope {
+  const char *left;
+  const char *right;
+  const char *chars;
+  Arena *arena;
+};
+
+// Polynomial hash of the characters. Passing the hash of a string continues it over
+// more characters, and combineHashes() gives the hash of a + b from those of a and b
+// without looking at the characters.
+constexpr uint32_t STRING_HASH_BASE = 16777619u;
+inline uint32_t hashString(const char *chars, size_t length, uint32_t hash = 0) {
+  for (size_t i = 0; i < length; i++) {
+    hash = hash * STRING_HASH_BASE + static_cast<uint8_t>(chars[i]);
+  }
+  return hash;
+}
+inline uint32_t combineHashes(uint32_t a, uint32_t b, size_t lengthOfB) {
+  uint32_t power = 1;
+  for (uint32_t base = STRING_HASH_BASE; lengthOfB != 0; lengthOfB >>= 1, base *= base) {
+    if (lengthOfB & 1) power *= base;
+  }
+  return a * power + b;
+}
+
+inline const StringHeader &stringHeader(const char *handle) {
+  return *reinterpret_cast<const StringHeader *>(handle - sizeof(StringHeader));
+}
+inline size_t stringLength(const char *handle) { return stringHeader(handle).length; }
+inline Rope &stringRope(const char *handle) {
+  return *reinterpret_cast<Rope *>(const_cast<char *>(handle));
+}
+
+// Calls f with the pieces of a string in order, without putting a rope together.
+template <typename F>
+inline void forEachPiece(const char *handle, F f) {
+  if (stringHeader(handle).pool != 0) {
+    f(std::string_view(handle, stringLength(handle)));
+    return;
+  }
+  std::vector<const char *> pending{handle};
+  while (!pending.empty()) {
+    const char *piece = pending.back();
+    pending.pop_back();
+    const StringHeader &header = stringHeader(piece);
+    if (header.pool != 0) {
+      f(std::string_view(piece, header.length));
+    } else if (const Rope &rope = stringRope(piece); rope.chars != nullptr) {
+      f(std::string_view(rope.chars, header.length));
+    } else {
+      pending.push_back(rope.right);
+      pending.push_back(rope.left);
+    }
+  }
+}
+
+inline std::string_view stringView(const char *handle) {
+  const StringHeader &header = stringHeader(handle);
+  if (header.pool != 0) return std::string_view(handle, header.length);
+  Rope &rope = stringRope(handle);
+  if (rope.chars == nullptr) {
+    char *chars = static_cast<char *>(rope.arena->allocate(header.length + 1, 1));
+    size_t at = 0;
+    forEachPiece(handle, [&](std::string_view piece) {
+      piece.copy(chars + at, piece.size());
+      at += piece.size();
+    });
+    chars[at] = '\0';
+    rope.chars = chars;
+  }
+  return std::string_view(rope.chars, header.length);
+}
+
+// Strings interned by the same pool are unique, so two of them are equal exactly
+// when their handles are. Otherwise the lengths and hashes are compared before the
+// characters.
+inline bool stringsEqual(const char *a, const char *b) {
+  if (a == b) return true;
+  const StringHeader &first = stringHeader(a), &second = stringHeader(b);
+  if (first.pool != 0 && first.pool == second.pool) return false;
+  if (first.length != second.length || first.hash != second.hash) return false;
+  return stringView(a) == stringView(b);
+}
+
+// Every distinct string that outlives a run (a constant, a global, a value passed
+// in or returned) is stored exactly once in the pool of its VM, and values refer to
+// it by handle, so copying a string value is a pointer copy. A VM shares its pool
+// with its contexts and the programs it compiles, like its GlobalTable, and the
+// strings are freed when the last of them goes away.
+//
+// Value interns strings made from host text into the current pool of the thread:
+// the pool of a StringPoolScope (the VM compiling or loading a program), else the
+// pool of the VM created last on the thread that is still alive, else a pool that
+// lives as long as the process.
+//
+// Handles are kept in an open-addressed table keyed by the stored hash, and the
+// strings are allocated from large blocks.
+struct StringPool {
+  static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+  const uint32_t id;
+  std::mutex mutex;
+  std::vector<const char *> table; // power of two entries, nullptr if empty
+  size_t count = 0;
+  std::vector<std::unique_ptr<char[]>> blocks;
+  char *next = nullptr;
+  size_t available = 0;
+
+  StringPool() : id(nextId()) {}
+  ~StringPool() = default;
+  StringPool(const StringPool &) = delete;
+  StringPool &operator=(const StringPool &) = delete;
+
+  static uint32_t nextId() {
+    static std::atomic<uint32_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
+  static StringPool &process() {
+    static StringPool pool;
+    return pool;
+  }
+  // Pool of the innermost StringPoolScope on this thread, or nullptr.
+  static StringPool *&active() {
+    thread_local StringPool *pool = nullptr;
+    return pool;
+  }
+  // Pools of the VMs created on this thread, most recent last.
+  static std::vector<std::weak_ptr<StringPool>> &threadDefaults() {
+    thread_local std::vector<std::weak_ptr<StringPool>> pools;
+    return pools;
+  }
+  static StringPool &current() {
+    if (StringPool *pool = active()) return *pool;
+    auto &defaults = threadDefaults();
+    while (!defaults.empty()) {
+      if (auto pool = defaults.back().lock()) return *pool;
+      defaults.pop_back();
+    }
+    return process();
+  }
+  // Make `pool` the current pool of this thread until forget(pool) or until a later
+  // pool is made current.
+  static void makeDefault(const std::shared_ptr<StringPool> &pool) {
+    threadDefaults().push_back(pool);
+  }
+  static void forget(const StringPool *pool) {
+    auto &defaults = threadDefaults();
+    for (size_t i = defaults.size(); i-- > 0;) {
+      auto held = defaults[i].lock();
+      if (held == nullptr || held.get() == pool) defaults.erase(defaults.begin() + i);
+    }
+  }
+
+  const char *intern(std::string_view str) {
+    const uint32_t hash = hashString(str.data(), str.size());
+    std::lock_guard<std::mutex> lock(mutex);
+    return findOrAdd(str, hash);
+  }
+  // Whether `handle` stays valid as long as this pool: interned by it or by the
+  // process pool.
+  bool holds(const char *handle) const {
+    const uint32_t pool = stringHeader(handle).pool;
+    return pool == id || pool == process().id;
+  }
+  // A string equal to `handle` that this pool holds. Temporary strings and strings
+  // of other pools are interned.
+  const char *keep(const char *handle) {
+    if (holds(handle)) return handle;
+    const std::string_view str = stringView(handle);
+    std::lock_guard<std::mutex> lock(mutex);
+    return findOrAdd(str, stringHeader(handle).hash);
+  }
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return count;
+  }
+
+  // The polynomial hash is weak in its low bits, which index the table.
+  static size_t slot(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+  }
+  const char *findOrAdd(std::string_view str, uint32_t hash) {
+    const size_t length = str.size();
+    if (table.empty()) table.assign(64, nullptr);
+    size_t mask = table.size() - 1;
+    size_t index = slot(hash) & mask;
+    for (; table[index] != nullptr; index = (index + 1) & mask) {
+      const char *handle = table[index];
+      const StringHeader &header = stringHeader(handle);
+      if (header.hash == hash && header.length == length &&
+          str.compare(0, length, handle, length) == 0) {
+        return handle;
+      }
+    }
+    char *handle = allocate(length);
+    str.copy(handle, length);
+    handle[length] = '\0';
+    auto *header = reinterpret_cast<StringHeader *>(handle - sizeof(StringHeader));
+    header->length = length;
+    header->hash = hash;
+    header->pool = id;
+    // Keep the table at most half full.
+    if (2 * (count + 1) > table.size()) {
+      grow();
+      mask = table.size() - 1;
+      for (index = slot(hash) & mask; table[index] != nullptr; index = (index + 1) & mask) {
+      }
+    }
+    table[index] = handle;
+    count++;
+    return handle;
+  }
+  // Room for a header and `length` characters plus the terminator. Strings larger
+  // than a quarter block get a block of their own.
+  char *allocate(size_t length) {
+    constexpr size_t align = alignof(StringHeader);
+    const size_t size = (sizeof(StringHeader) + length + 1 + align - 1) & ~(align - 1);
+    if (size > BLOCK_SIZE / 4) {
+      blocks.push_back(std::make_unique<char[]>(size));
+      return blocks.back().get() + sizeof(StringHeader);
+    }
+    if (size > available) {
+      blocks.push_back(std::make_unique<char[]>(BLOCK_SIZE));
+      next = blocks.back().get();
+      available = BLOCK_SIZE;
+    }
+    char *memory = next;
+    next += size;
+    available -= size;
+    return memory + sizeof(StringHeader);
+  }
+  void grow() {
+    std::vector<const char *> old(table.size() * 2, nullptr);
+    old.swap(table);
+    const size_t mask = table.size() - 1;
+    for (const char *handle : old) {
+      if (handle == nullptr) continue;
+      size_t index = slot(stringHeader(handle).hash) & mask;
+      while (table[index] != nullptr) index = (index + 1) & mask;
+      table[index] = handle;
+    }
+  }
+};
+
+// Makes `pool` the current pool of this thread while the scope lasts.
+struct StringPoolScope {
+  StringPool *previous;
+
+  explicit StringPoolScope(StringPool &pool) : previous(StringPool::active()) {
+    StringPool::active() = &pool;
+  }
+  ~StringPoolScope() { StringPool::active() = previous; }
+  StringPoolScope(const StringPoolScope &) = delete;
+  StringPoolScope &operator=(const StringPoolScope &) = delete;
+};
+
+inline const char *internString(std::string_view str) { return StringPool::current().intern(str); }
+
+// Strings made by concatenation while a context runs a script. a + b is a Rope
+// allocated from the context's arena that refers to both halves, so building a
+// string piece by piece costs constant time and memory per step and takes no lock.
+// Before the run returns, the context interns the temporary strings that outlive it
+// with StringPool::keep() and calls reset(), which frees the rest at once.
+struct TemporaryStrings {
+  struct Node {
+    StringHeader header;
+    Rope rope;
+  };
+  static_assert(offsetof(Node, rope) == sizeof(StringHeader), "the header must precede the rope");
+
+  Arena arena;
+  size_t count = 0; // ropes made since the last reset
+
+  TemporaryStrings() = default;
+  ~TemporaryStrings() = default;
+  TemporaryStrings(const TemporaryStrings &) = delete;
+  TemporaryStrings &operator=(const TemporaryStrings &) = delete;
+
+  const char *concat(const char *a, const char *b) {
+    const StringHeader &first = stringHeader(a), &second = stringHeader(b);
+    if (second.length == 0) return a;
+    if (first.length == 0) return b;
+    auto *node = static_cast<Node *>(arena.allocate(sizeof(Node), alignof(Node)));
+    node->header = {first.length + second.length,
+                    combineHashes(first.hash, second.hash, second.length), 0};
+    node->rope = {a, b, nullptr, &arena};
+    count++;
+    return reinterpret_cast<const char *>(&node->rope);
+  }
+  bool empty() const { return count == 0; }
+  void reset() {
+    arena.reset();
+    count = 0;
+  }
+};
+
+} // namespace pips
+#endif // PIPS_STRINGS_HPP_
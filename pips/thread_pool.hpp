@@ -0,0 +1,151 @@
+#ifndef PIPS_THREAD_POOL_HPP_
+#define PIPS_THREAD_POOL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pips {
+
+// Fixed-size work-stealing pool for data-parallel loops. Every participant owns a
+// task deque: it pops its own tasks from the back and, when that is empty, steals
+// from the front of the others' deques, so uneven chunks even out on their own.
+// The thread calling parallelFor() is one of the participants, so a pool of
+// concurrency n runs n - 1 background threads.
+struct ThreadPool {
+  struct Job {
+    std::function<void(size_t worker, size_t begin, size_t end)> body;
+    std::atomic<size_t> remaining{0};
+  };
+  struct Task {
+    Job *job;
+    size_t begin;
+    size_t end;
+  };
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues; // one per participant, caller last
+  std::vector<std::thread> threads;
+  std::atomic<size_t> queued{0};
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  bool stopping = false;
+  std::mutex runMutex; // one parallelFor at a time
+
+  // `concurrency` participants including the caller; 0 uses every hardware thread.
+  explicit ThreadPool(size_t concurrency = 0) {
+    if (concurrency == 0) concurrency = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < concurrency; i++) {
+      queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i + 1 < concurrency; i++) {
+      threads.emplace_back([this, i] { workerLoop(i); });
+    }
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads) thread.join();
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t concurrency() const { return queues.size(); }
+
+  // Call body(worker, begin, end) for consecutive ranges of at most `grain`
+  // elements covering [0, n), and return once all of them have finished. `worker`
+  // is below concurrency() and no two ranges run with the same worker at once,
+  // so it can index per-thread state.
+  template <typename F>
+  void parallelFor(size_t n, size_t grain, F &&body) {
+    if (n == 0) return;
+    grain = std::max<size_t>(grain, 1);
+    std::lock_guard<std::mutex> run(runMutex);
+    Job job;
+    job.body = std::forward<F>(body);
+    const size_t chunks = (n + grain - 1) / grain;
+    job.remaining.store(chunks);
+    // Deal the chunks round-robin; stealing evens out whatever imbalance is left.
+    for (size_t c = 0; c < chunks; c++) {
+      const size_t begin = c * grain;
+      Queue &queue = *queues[c % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(Task{&job, begin, std::min(n, begin + grain)});
+    }
+    queued.fetch_add(chunks);
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_all();
+
+    const size_t self = queues.size() - 1;
+    Task task;
+    while (take(self, task)) execute(task, self);
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    done.wait(lock, [&] { return job.remaining.load() == 0; });
+  }
+
+  bool take(size_t self, Task &task) {
+    // Newest own task first, for locality.
+    {
+      Queue &own = *queues[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = own.tasks.back();
+        own.tasks.pop_back();
+        queued.fetch_sub(1);
+        return true;
+      }
+    }
+    // Otherwise steal the oldest task of another participant.
+    for (size_t k = 1; k < queues.size(); k++) {
+      Queue &victim = *queues[(self + k) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = victim.tasks.front();
+        victim.tasks.pop_front();
+        queued.fetch_sub(1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void execute(const Task &task, size_t worker) {
+    task.job->body(worker, task.begin, task.end);
+    if (task.job->remaining.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      done.notify_all();
+    }
+  }
+
+  void workerLoop(size_t self) {
+    for (;;) {
+      Task task;
+      if (take(self, task)) {
+        execute(task, self);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait(lock, [&] { return stopping || queued.load() > 0; });
+      if (stopping) return;
+    }
+  }
+};
+
+} // namespace pips
+#endif // PIPS_THREAD_POOL_HPP_
@@ -3,15 +3,20 @@
 
 namespace pips {
 
-#ifndef STRING_MAX
-#define STRING_MAX 64 
+// Default limit on the number of values on a context's stack (see
+// Context::stackLimit). The stack only grows to what the programs run need.
+#ifndef STACK_MAX
+#define STACK_MAX 65536
 #endif
 
-#ifndef STACK_MAX
-#define STACK_MAX 256 
+// Numeric type of the default instantiations (VM<>, Value<>, ...). The VM, values,
+// compiler and math helpers are templates on the numeric type, so float, double and
+// long double VMs can coexist in one binary. NaN-boxed values require double.
+#ifndef PIPS_REAL
+#define PIPS_REAL double
 #endif
 
-using Real = long double;
+using DefaultReal = PIPS_REAL;
 
 } // namespace pips
 
@@ -1,8 +1,10 @@
 #ifndef PIPS_UTILS_HPP_
 #define PIPS_UTILS_HPP_
 
+#include <cstdlib>
 #include <limits>
 #include <string>
+#include <type_traits>
 
 namespace pips {
 
@@ -36,17 +38,23 @@ constexpr auto to_underlying(E e) noexcept {
   return static_cast<std::underlying_type_t<E>>(e);
 }
 
+// Parse a number literal with the precision of the VM's numeric type.
+template <typename Real>
+inline Real parseReal(const char *str) {
+  if constexpr (std::is_same_v<Real, float>) {
+    return std::strtof(str, nullptr);
+  } else if constexpr (std::is_same_v<Real, long double>) {
+    return std::strtold(str, nullptr);
+  } else {
+    return static_cast<Real>(std::strtod(str, nullptr));
+  }
+}
+
 inline std::string getKey(const char *chars) {
   std::string key = chars;
   return key;
 }
 
-inline void StringToChar(std::string str, char *buff) {
-  size_t len = std::min(str.length(), static_cast<size_t>(STRING_MAX - 1));
-  std::memcpy(buff, str.c_str(), len);
-  buff[len] = '\0';
-}
-
 } // namespace Utils
 } // namespace pips
 #endif // PIPS_UTILS_HPP_
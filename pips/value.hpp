@@ -9,6 +9,8 @@
 // The code was adapted for C++ and simplified in many ways.
 //===========================================================================
 
+#include <cstdio>
+
 #include "value_types.hpp"
 
 namespace pips {
@@ -18,27 +20,42 @@ namespace pips {
 #define NUMBER_VAL(value) (Value(value))
 #define STRING_VAL(value) (Value(value))
 
+#ifdef PIPS_NAN_BOXING
+#define IS_BOOL(value) (((value).bits | 1) == NanBox::TRUE_BITS)
+#define IS_NIL(value) ((value).bits == NanBox::NIL_BITS)
+#define IS_NUMBER(value) (((value).bits & NanBox::QNAN) != NanBox::QNAN)
+#define IS_STRING(value)                                                                 \
+  (((value).bits & (NanBox::QNAN | NanBox::SIGN_BIT)) == (NanBox::QNAN | NanBox::SIGN_BIT))
+
+#define AS_BOOL(value) ((value).bits == NanBox::TRUE_BITS)
+#define AS_NUMBER(value) ((value).asNumber())
+#define AS_STRING(value) ((value).asString())
+
+#define VALUE_TYPE(value) ((value).type())
+#else
 #define IS_BOOL(value) ((value).type == ValueType::BOOL)
 #define IS_NIL(value) ((value).type == ValueType::NIL)
 #define IS_NUMBER(value) ((value).type == ValueType::NUMBER)
 #define IS_STRING(value) ((value).type == ValueType::STRING)
-#define IS_NUMERIC(value) ((value).type == ValueType::NUMBER || (value).type == ValueType::BOOL)
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
 #define AS_STRING(value) ((value).as.str)
 
-extern void printObject(Value val);
+#define VALUE_TYPE(value) ((value).type)
+#endif
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_BOOL(value))
 
-
-inline int64_t AS_INTEGER(const Value &val) {
+template <typename Real>
+inline int64_t AS_INTEGER(const Value<Real> &val) {
   if (IS_BOOL(val)) {
     return AS_BOOL(val) ? 1 : 0;
   }
   return static_cast<int64_t>(AS_NUMBER(val));
 }
 
-inline int64_t IS_INTEGRAL(const Value &val) {
+template <typename Real>
+inline int64_t IS_INTEGRAL(const Value<Real> &val) {
   if (IS_BOOL(val)) {
     return true;
   }
@@ -51,8 +68,9 @@ inline int64_t IS_INTEGRAL(const Value &val) {
   return false;
 }
 
-inline void printValue(const Value &val) {
-  switch (val.type) {
+template <typename Real>
+inline void printValue(const Value<Real> &val) {
+  switch (VALUE_TYPE(val)) {
   case ValueType::BOOL:
     printf(AS_BOOL(val) ? "true" : "false");
     break;
@@ -63,16 +81,45 @@ inline void printValue(const Value &val) {
     printf("%.16lg", static_cast<double>(AS_NUMBER(val)));
     break;
   case ValueType::STRING:
-    printf("%s", val.as.str);
+    forEachPiece(AS_STRING(val), [](std::string_view piece) {
+      std::fwrite(piece.data(), 1, piece.size(), stdout);
+    });
     break;
   }
 }
 
-inline bool stringCompare(Value a, Value b) {
-  if (a.type != ValueType::STRING || b.type != ValueType::STRING) return false;
-  return std::strcmp(a.as.str, b.as.str) == 0;
+// The string a + b of two string values, a temporary string of `strings`.
+template <typename Real>
+inline Value<Real> concatenate(const Value<Real> &a, const Value<Real> &b,
+                               TemporaryStrings &strings) {
+  return Value<Real>(InternedString{strings.concat(AS_STRING(a), AS_STRING(b))});
+}
+
+// The value itself, or a copy interned by `pool` if it is a string `pool` does not
+// hold (see StringPool::keep).
+template <typename Real>
+inline Value<Real> keepValue(const Value<Real> &val, StringPool &pool) {
+  if (!IS_STRING(val)) return val;
+  return Value<Real>(InternedString{pool.keep(AS_STRING(val))});
+}
+
+template <typename Real>
+inline bool stringCompare(const Value<Real> &a, const Value<Real> &b) {
+  if (!IS_STRING(a) || !IS_STRING(b)) return false;
+  return stringsEqual(AS_STRING(a), AS_STRING(b));
+}
+#ifdef PIPS_NAN_BOXING
+template <typename Real>
+inline bool valuesEqual(const Value<Real> &a, const Value<Real> &b) {
+  // Numbers compare as doubles (NaN != NaN, -0 == 0), strings by stringsEqual;
+  // everything else is equal exactly when the bits are.
+  if (IS_NUMBER(a) && IS_NUMBER(b)) return AS_NUMBER(a) == AS_NUMBER(b);
+  if (a.bits == b.bits) return true;
+  return IS_STRING(a) && IS_STRING(b) && stringsEqual(AS_STRING(a), AS_STRING(b));
 }
-inline bool valuesEqual(Value a, Value b) {
+#else
+template <typename Real>
+inline bool valuesEqual(const Value<Real> &a, const Value<Real> &b) {
   if (a.type != b.type) return false;
   switch (a.type) {
   case ValueType::BOOL:
@@ -88,5 +135,6 @@ inline bool valuesEqual(Value a, Value b) {
     return false;
   }
 }
+#endif
 } // namespace pips
 #endif // PIPS_VALUE_HPP_
@@ -8,25 +8,107 @@
 // https://github.com/munificent/craftinginterpreters under the MIT License.
 // The code was adapted for C++ and simplified in many ways.
 //===========================================================================
+#include "strings.hpp"
 #include "types.hpp"
+#include <cstdint>
 #include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
 
 namespace pips {
 
-inline void StringToChar(std::string str, char *buff) {
-  size_t len = std::min(str.length(), static_cast<size_t>(STRING_MAX - 1));
-  std::memcpy(buff, str.c_str(), len);
-  buff[len] = '\0';
+enum class ValueType : uint8_t { BOOL, NIL, STRING, NUMBER };
+
+template <typename T>
+inline constexpr bool is_string_like() {
+  return std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view> ||
+         std::is_same_v<T, const char *> || std::is_same_v<T, char *>;
 }
 
-enum class ValueType { BOOL, NIL, STRING, NUMBER };
+// A string handle from a StringPool or TemporaryStrings, which values take
+// without interning again.
+struct InternedString {
+  const char *handle;
+};
+
+#ifdef PIPS_NAN_BOXING
+static_assert(sizeof(void *) == 8, "PIPS_NAN_BOXING requires 64-bit pointers.");
+static_assert(std::numeric_limits<double>::is_iec559,
+              "PIPS_NAN_BOXING requires IEEE-754 doubles.");
+
+// Every value is packed into a single 64-bit word. Anything that is not a quiet NaN
+// with the bits below set is a double. nil, false and true are NaNs with a small tag
+// in the low bits, and strings are NaNs with the sign bit set and the string
+// handle in the low 48 bits (as in clox). Numbers that are NaN are stored as
+// CANONICAL_NAN so that their bits never reach the tag space.
+struct NanBox {
+  static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+  static constexpr uint64_t QNAN = 0x7ffc000000000000;
+  static constexpr uint64_t CANONICAL_NAN = 0x7ff8000000000000;
+  static constexpr uint64_t NIL_BITS = QNAN | 1;
+  static constexpr uint64_t FALSE_BITS = QNAN | 2;
+  static constexpr uint64_t TRUE_BITS = QNAN | 3;
+};
 
+template <typename Real = DefaultReal>
 struct Value {
+  static_assert(std::is_same_v<Real, double>, "PIPS_NAN_BOXING requires Real to be double.");
+
+  uint64_t bits;
+
+  Value() { bits = NanBox::NIL_BITS; }
+  template <typename T>
+  Value(T v) {
+    if constexpr (is_string_like<T>()) {
+      bits = NanBox::SIGN_BIT | NanBox::QNAN | reinterpret_cast<uintptr_t>(internString(v));
+    } else if constexpr (std::is_same_v<T, InternedString>) {
+      bits = NanBox::SIGN_BIT | NanBox::QNAN | reinterpret_cast<uintptr_t>(v.handle);
+    } else if constexpr (std::is_same_v<T, bool>) {
+      bits = v ? NanBox::TRUE_BITS : NanBox::FALSE_BITS;
+    } else if constexpr (std::is_arithmetic_v<T>) {
+      const double num = static_cast<double>(v);
+      if (num != num) {
+        bits = NanBox::CANONICAL_NAN;
+      } else {
+        std::memcpy(&bits, &num, sizeof(double));
+      }
+    } else {
+      static_assert(std::is_arithmetic_v<T>, "Unsupported type for Value");
+    }
+  }
+
+  double asNumber() const {
+    double num;
+    std::memcpy(&num, &bits, sizeof(double));
+    return num;
+  }
+  const char *asString() const {
+    return reinterpret_cast<const char *>(
+        static_cast<uintptr_t>(bits & ~(NanBox::SIGN_BIT | NanBox::QNAN)));
+  }
+  ValueType type() const {
+    if ((bits & NanBox::QNAN) != NanBox::QNAN) return ValueType::NUMBER;
+    if (bits == NanBox::NIL_BITS) return ValueType::NIL;
+    if ((bits | 1) == NanBox::TRUE_BITS) return ValueType::BOOL;
+    return ValueType::STRING;
+  }
+};
+
+static_assert(sizeof(Value<double>) == sizeof(uint64_t), "NaN-boxed Value must be one word");
+#else
+// Values are trivially copyable: a one byte tag next to either a number, a bool or a
+// string handle (16 bytes when Real is double).
+template <typename Real = DefaultReal>
+struct Value {
+  static_assert(std::is_floating_point_v<Real>, "Real must be a floating point type.");
+
   ValueType type;
   union {
     bool boolean;
     Real number;
-    char str[STRING_MAX];
+    const char *str;
   } as;
 
   Value() {
@@ -35,9 +117,12 @@ struct Value {
   }
   template <typename T>
   Value(T v) {
-    if constexpr (std::is_same_v<T, std::string>) {
+    if constexpr (is_string_like<T>()) {
+      type = ValueType::STRING;
+      as.str = internString(v);
+    } else if constexpr (std::is_same_v<T, InternedString>) {
       type = ValueType::STRING;
-      StringToChar(v, as.str);
+      as.str = v.handle;
     } else if constexpr (std::is_same_v<T, bool>) {
       type = ValueType::BOOL;
       as.boolean = v;
@@ -45,49 +130,15 @@ struct Value {
       type = ValueType::NUMBER;
       as.number = static_cast<Real>(v);
     } else {
-      static_assert("Unsupported type for Value");
+      static_assert(std::is_arithmetic_v<T>, "Unsupported type for Value");
     }
   }
+};
 
-  Value(const Value &other) {
-    type = other.type;
-    switch (type) {
-    case ValueType::BOOL:
-      as.boolean = other.as.boolean;
-      break;
-    case ValueType::NIL:
-      as.number = 0;
-      break;
-    case ValueType::STRING:
-      std::strcpy(as.str, other.as.str);
-      break;
-    case ValueType::NUMBER:
-      as.number = other.as.number;
-      break;
-    }
-  }
+static_assert(sizeof(Value<double>) <= 16, "Value<double> should be a tag plus a double");
+#endif
 
-  Value &operator=(const Value &other) {
-    if (this != &other) {
-      type = other.type;
-      switch (type) {
-      case ValueType::BOOL:
-        as.boolean = other.as.boolean;
-        break;
-      case ValueType::NIL:
-        as.number = 0;
-        break;
-      case ValueType::STRING:
-        std::strcpy(as.str, other.as.str);
-        break;
-      case ValueType::NUMBER:
-        as.number = other.as.number;
-        break;
-      }
-    }
-    return *this;
-  }
-};
+static_assert(std::is_trivially_copyable_v<Value<>>, "Value must stay trivially copyable");
 
 } // namespace pips
 #endif // PIPS_VALUE_TYPES_HPP_
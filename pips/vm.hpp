@@ -8,116 +8,76 @@
 // The code was adapted for C++ and simplified in many ways.
 //===========================================================================
 
-// #define DEBUG_TRACE_EXECUTION
-
-
-#include <cstring>
+#include <cstdio>
 #include <iostream>
-#include <stdarg.h>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
 
-#include "math.hpp"
-#include "types.hpp"
+#include "arena.hpp"
+#include "bytecode.hpp"
+#include "cache.hpp"
 #include "chunk.hpp"
 #include "compiler.hpp"
+#include "context.hpp"
+#include "globals.hpp"
+#include "jit.hpp"
+#include "optimizer.hpp"
+#include "program.hpp"
+#include "register.hpp"
 #include "scanner.hpp"
+#include "types.hpp"
 #include "utils.hpp"
 #include "value.hpp"
 
 namespace pips {
 
-using VTable = std::unordered_map<std::string, Value>;
-
-enum class InterpretResult { OK, COMPILE_ERROR, RUNTIME_ERROR };
-// ObjString *takeString(VM *vm, char *chars, int length);
-
 // NOTE: The VM needs to be runnable on device and host, so limit the
 //       use of data structures used (e.g., no std::vector)
 //   But does the compiler also need to run on device?????
 
-// TODO: convert this to member function of VM
-#define BINARY_OP(valueType, op)                                                         \
-  do {                                                                                   \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                                    \
-      runtimeError("Operands must be numbers.");                                         \
-      return InterpretResult::RUNTIME_ERROR;                                             \
-    }                                                                                    \
-    Real b = AS_NUMBER(pop());                                                    \
-    Real a = AS_NUMBER(pop());                                                    \
-    push(valueType(a op b));                                                             \
-  } while (false)
-
-#define MOD_OP(valueType)                                                                \
-  do {                                                                                   \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                                    \
-                                                                                         \
-      runtimeError("Operands must be numbers.");                                         \
-      return InterpretResult::RUNTIME_ERROR;                                             \
-    }                                                                                    \
-    Real b = AS_NUMBER(pop());                                                    \
-    Real a = AS_NUMBER(pop());                                                    \
-    push(                                                                                \
-        valueType(static_cast<Real>(static_cast<int>(a) % static_cast<int>(b)))); \
-  } while (false)
-
-#define INTDIVIDE_OP(valueType)                                                          \
-  do {                                                                                   \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                                    \
-                                                                                         \
-      runtimeError("Operands must be numbers.");                                         \
-      return InterpretResult::RUNTIME_ERROR;                                             \
-    }                                                                                    \
-    Real b = AS_NUMBER(pop());                                                    \
-    Real a = AS_NUMBER(pop());                                                    \
-    push(valueType(static_cast<Real>(static_cast<int>(a / b))));                  \
-  } while (false)
-
-#define STD_BINARY_OP(func,valueType)                                                              \
-  do {                                                                                   \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                                    \
-      runtimeError("Operands must be numbers.");                                         \
-      return InterpretResult::RUNTIME_ERROR;                                             \
-    }                                                                                    \
-    Real b = AS_NUMBER(pop());                                                    \
-    Real a = AS_NUMBER(pop());                                                    \
-    push(valueType(func(a, b)));                                                     \
-  } while (false)
-
-#define BITWISE_OP(op)                                                                   \
-  do {                                                                                   \
-    if (!IS_INTEGRAL(peek(0)) || !IS_INTEGRAL(peek(1))) {                                \
-      runtimeError("Operands must be convertable to integers.");                         \
-      return InterpretResult::RUNTIME_ERROR;                                             \
-    }                                                                                   \
-    if (IS_BOOL(peek(0)) && IS_BOOL(peek(1))) {                                         \
-      bool b = AS_BOOL(pop());                                                        \
-      bool a = AS_BOOL(pop());                                                         \
-      push(BOOL_VAL(a op b));                                                          \
-    } else {                                                                            \
-      int64_t b = AS_INTEGER(pop());                                                     \
-      int64_t a = AS_INTEGER(pop());                                                     \
-      push(NUMBER_VAL(a op b));                                                         \
-    }                                                                                   \
-  } while (false)
-
-struct VM {
-  Chunk *chunk;
-  uint8_t *ip;
-  Value stack[STACK_MAX];
-  Value *stackTop;
-
-  // Table strings;
-  VTable globals;
-
+// Compiles scripts and runs them on its own context. Programs it compiles can also
+// be run concurrently by other contexts created from it (see Context).
+template <typename Real = DefaultReal>
+struct VM : Context<Real> {
+  using Value = pips::Value<Real>;
+  using Chunk = pips::Chunk<Real>;
+  using Program = pips::Program<Real>;
+  using Compiler = pips::Compiler<Real>;
+  using Context = pips::Context<Real>;
+  using VTable = pips::VTable<Real>;
+  using Context::globalNames;
+  using Context::stringPool;
+  using Context::run;
+
+  // Serializes compilation, which adds names to the shared global table.
+  std::mutex compileMutex;
   Compiler *current;
-
-  VM() {
-    // reset the stack pointer
-    stackTop = stack;
-    current = nullptr;
+  // Memory for the compiler and the passes over the code, reset for every
+  // compilation (see Arena). Guarded by compileMutex.
+  Arena arena;
+  // Program that interpret() compiles into when the cache is disabled, reused so
+  // that its code and constants keep their capacity from one call to the next.
+  Program scratch;
+
+  // Compiled programs reused by interpret(). Disabled (capacity 0) by default.
+  ProgramCache<Real> cache;
+
+  // Backend of programs compiled without naming one, including by interpret().
+  Backend backend = Backend::STACK;
+  // Run the peephole optimizer on everything compiled (see PeepholeOptimizer).
+  bool optimize = false;
+
+  // `stackLimit` bounds the stack of the VM and, by default, of contexts created from
+  // it: programs needing more values fail to run.
+  explicit VM(size_t stackLimit = STACK_MAX)
+      : Context(std::make_shared<GlobalTable>(), std::make_shared<StringPool>(), stackLimit),
+        current(nullptr) {
+    // Strings the host makes while this VM lives are interned into its pool.
+    StringPool::makeDefault(stringPool);
+    scratch.strings = stringPool;
   }
-  ~VM() = default; //{ freeObjects(); }
+  ~VM() { StringPool::forget(stringPool.get()); }
 
   // void freeObject(Obj *object) {
   //   switch (object->type) {
@@ -144,426 +104,137 @@ struct VM {
     current = compiler;
   }
 
-  void runtimeError(const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
-    va_end(args);
-    std::fputs("\n", stderr);
-
-    size_t instruction = ip - chunk->code.data() - 1;
-    int line = chunk->lines[instruction];
-    std::fprintf(stderr, "[line %d] in script\n", line);
-    stackTop = stack;
+  // Compile source into an owned, immutable program that can be passed to run()
+  // repeatedly. Returns nullptr if compilation failed. Names listed in `inputs`
+  // are read from the input frame given to run() instead of from globals.
+  std::shared_ptr<const Program> compile(const char *source, char end_line = ';',
+                                         std::vector<std::string> inputs_ = {}) {
+    return compile(source, end_line, std::move(inputs_), backend);
   }
-
-  void push(Value val) {
-    *stackTop = val;
-    stackTop++;
+  std::shared_ptr<const Program> compile(const char *source, char end_line,
+                                         std::vector<std::string> inputs_, Backend backend_) {
+    auto program = std::make_shared<Program>();
+    program->strings = stringPool;
+    program->end_line = end_line;
+    program->inputs = std::move(inputs_);
+    if (!compile(source, end_line, &program->chunk, &program->inputs) ||
+        !selectBackend(*program, backend_)) {
+      return nullptr;
+    }
+    return program;
   }
-  Value pop() {
-    stackTop--;
-    return *stackTop;
+  // Write a compiled program to `path` in the bytecode format (see bytecode.hpp).
+  bool save(const Program &program, const std::string &path) const {
+    return bytecode::writeFile(path, bytecode::serialize(program, *globalNames));
   }
-  Value peek(int dist) { return stackTop[-1 - dist]; }
-  bool isFalsey(Value val) { return IS_NIL(val) || (IS_BOOL(val) && !AS_BOOL(val)) || (IS_INTEGRAL(val) && AS_INTEGER(val) == 0); }
-  void concatenate() {
-    std::string a_str = (pop()).as.str;
-    std::string b_str = (pop()).as.str;
-    push(Value(b_str + a_str));
+  // Load a program saved by save(), in this or another process, to run on this VM's
+  // backend. The file is mapped and copied into the program without compiling
+  // anything. Returns nullptr, with a message on stderr, if it cannot be used.
+  std::shared_ptr<const Program> load(const std::string &path) {
+    bytecode::MappedFile file;
+    if (!file.open(path)) {
+      std::fprintf(stderr, "Could not open file \"%s\".\n", path.c_str());
+      return nullptr;
+    }
+    auto program = std::make_shared<Program>();
+    program->strings = stringPool;
+    StringPoolScope poolScope(*stringPool);
+    const std::string error =
+        bytecode::deserialize(file.data, file.size, *globalNames, *program);
+    if (!error.empty()) {
+      std::fprintf(stderr, "Could not load \"%s\": %s.\n", path.c_str(), error.c_str());
+      return nullptr;
+    }
+    if (!selectBackend(*program, backend)) return nullptr;
+    return program;
+  }
+
+  // Prepare a program compiled into its chunk to run on `backend_`.
+  bool selectBackend(Program &program, Backend backend_) {
+    std::lock_guard<std::mutex> lock(compileMutex);
+    ArenaScope scope(arena);
+    arena.reset();
+    program.backend = backend_;
+    program.native = nullptr;
+    if (backend_ == Backend::NATIVE) {
+      // Chunks the JIT cannot compile stay on the stack VM.
+      JitCompiler<Real> jit;
+      program.native = jit.compile(program.chunk);
+      if (program.native == nullptr) program.backend = Backend::STACK;
+      return true;
+    }
+    if (backend_ != Backend::REGISTER) return true;
+    // As do chunks too large for the register backend's 16-bit operands.
+    RegisterCompiler<Real> registerCompiler;
+    if (!registerCompiler.compile(program.chunk, program.inputs.size(), program.registerCode)) {
+      program.registerCode = RegisterChunk<Real>();
+      program.backend = Backend::STACK;
+    }
+    return true;
   }
-  InterpretResult run(VTable &locals) {
+  bool compile(const char *source, char end_line, Chunk *chunk_,
+               const std::vector<std::string> *inputs_ = nullptr) {
+    if (inputs_ != nullptr && inputs_->size() > UINT8_MAX + 1) {
+      std::fprintf(stderr, "Too many input variables.\n");
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(compileMutex);
+    ArenaScope scope(arena);
+    StringPoolScope poolScope(*stringPool);
+    arena.reset();
+    // Forward jumps that turn out too long for 16 bits are widened and the source
+    // compiled again. Widening only makes code longer, so this ends.
+    std::vector<uint8_t> longJumps;
     for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-      printf("        ");
-      for (Value *slot = stack; slot < stackTop; slot++) {
-        printf("[ ");
-        printValue(*slot);
-        printf(" ]");
-      }
-      printf("\n");
-      chunk->disassembleInstruction(static_cast<int>(ip - chunk->code.data()));
-#endif
-      uint8_t instruction;
-      switch (instruction = (*ip++)) {
-      case OpCode::NEGATE: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(-AS_NUMBER(pop())));
-        break;
-      }
-      case OpCode::UPLUS: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(AS_NUMBER(pop())));
-        break;
-      }
-      case OpCode::EXP: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::exp(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::SIN: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(pips::sin(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::COS: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(pips::cos(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::TAN: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(pips::tan(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::ABS: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::abs(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::LOG: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::log(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::LOG10: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::log10(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::SIGN: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL((AS_NUMBER(pop()) < 0.0 ? -1.0L : 1.0L)));
-        break;
-      }
-      case OpCode::SQRT: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::sqrt(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::ACOS: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::acos(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::ASIN: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::asin(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::ATAN: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::atan(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::ATAN2: {
-        STD_BINARY_OP(std::atan2, NUMBER_VAL);
-        break;
-      }
-      case OpCode::MIN: {
-        STD_BINARY_OP(std::min, NUMBER_VAL);
-        break;
-      }
-      case OpCode::MAX: {
-        STD_BINARY_OP(std::max, NUMBER_VAL);
-        break;
-      }
-      case OpCode::CEIL: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::ceil(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::FLOOR: {
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(std::floor(AS_NUMBER(pop()))));
-        break;
-      }
-      case OpCode::ADD: {
-        if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-          concatenate();
-        } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          Real b = AS_NUMBER(pop());
-          Real a = AS_NUMBER(pop());
-          push(NUMBER_VAL(a + b));
-        } else {
-          runtimeError("Operands must be two nuumbers or two strings!");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        break;
-      }
-      case OpCode::SUBTRACT: {
-        BINARY_OP(NUMBER_VAL, -);
-        break;
-      }
-      case OpCode::MULTIPLY: {
-        BINARY_OP(NUMBER_VAL, *);
-        break;
-      }
-      case OpCode::MOD: {
-        MOD_OP(NUMBER_VAL);
-        break;
-      }
-      case OpCode::DIVIDE: {
-        BINARY_OP(NUMBER_VAL, /);
-        break;
-      }
-      case OpCode::INTDIVIDE: {
-        INTDIVIDE_OP(NUMBER_VAL);
-        break;
-      }
-      case OpCode::POW: {
-        STD_BINARY_OP(std::pow, NUMBER_VAL);
-        break;
-      }
-      case OpCode::XOR: {
-        BITWISE_OP(^);
-        break;
-      }
-      case OpCode::BOR: {
-        BITWISE_OP(|);
-        break;
-      }
-      case OpCode::BAND: {
-        BITWISE_OP(&);
-        break;
-      }
-      case OpCode::BNOT: {
-        if (!IS_INTEGRAL(peek(0))) {
-          runtimeError("Operand must be an integer or boolean");
-          return InterpretResult::RUNTIME_ERROR;
-        }
-        if (IS_BOOL(peek(0))) {
-          push(BOOL_VAL(!AS_BOOL(pop())));
-        } else {
-          push(NUMBER_VAL(~AS_INTEGER(pop())));
-        }
-        break;
-      }
-      case OpCode::LSHIFT: {
-        BITWISE_OP(<<);
-        break;
-      }
-      case OpCode::RSHIFT: {
-        BITWISE_OP(>>);
-        break;
-      }
-      case OpCode::NOT: {
-        push(BOOL_VAL(isFalsey(pop())));
-        break;
-      }
-      case OpCode::RETURN: {
-        return InterpretResult::OK;
-        break;
-      }
-      case OpCode::POP:
-        pop();
-        break;
-      case OpCode::DEFINE_GLOBAL: {
-        std::string name = chunk->constants[(*ip++)].as.str;
-        globals[Utils::getKey(name.c_str())] = peek(0);
-        pop();
-        break;
-      }
-      case OpCode::SET_GLOBAL: {
-        std::string name = chunk->constants[(*ip++)].as.str;
-        auto key = Utils::getKey(name.c_str());
-        // for implicit declaration change to just
-        // global[key] = peek(0);
-        // This disallows implict declaration (must have var)
-        auto found = globals.find(key);
-        if (found == globals.end()) {
-          // exists
-          runtimeError("Undefined variable '%s'.", name.c_str());
-          return InterpretResult::RUNTIME_ERROR;
-        } else {
-          globals[key] = peek(0);
-        }
-        break;
-      }
-      case OpCode::GET_GLOBAL: {
-        std::string name = chunk->constants[(*ip++)].as.str;
-        auto found = locals.find(Utils::getKey(name.c_str()));
-        if (found == locals.end()) {
-          found = globals.find(Utils::getKey(name.c_str()));
-          if (found == globals.end()) {
-            runtimeError("Undefined variable '%s'.", name.c_str());
-            return InterpretResult::RUNTIME_ERROR;
-          }
-        }
-        push(found->second);
-        break;
-      }
-      case OpCode::GET_LOCAL: {
-        uint8_t slot = *ip++;
-        push(stack[slot]);
-        break;
-      }
-      case OpCode::SET_LOCAL: {
-        uint8_t slot = *ip++;
-        stack[slot] = peek(0);
-        break;
-      }
-      case OpCode::CONSTANT: {
-        Value constant = chunk->constants[(*ip++)];
-        push(constant);
-        break;
-      }
-      case OpCode::NIL: {
-        push(NIL_VAL);
-        break;
-      }
-      case OpCode::TRUE: {
-        push(BOOL_VAL(true));
-        break;
-      }
-      case OpCode::FALSE: {
-        push(BOOL_VAL(false));
-        break;
-      }
-      case OpCode::EQUAL: {
-        Value b = pop();
-        Value a = pop();
-        push(BOOL_VAL(valuesEqual(a, b)));
-        break;
-      }
-      case OpCode::GREATER:
-        BINARY_OP(BOOL_VAL, >);
-        break;
-      case OpCode::LESS:
-        BINARY_OP(BOOL_VAL, <);
-        break;
-      case OpCode::PRINT: {
-        printValue(pop());
-        printf(" ");
-        break;
-      }
-      case OpCode::LIST: {
-        for(const auto &v: locals) {
-          printf("%s = ", v.first.c_str());
-          printValue(v.second);
-          printf("\n");
-        }
-        for(const auto &v : globals) {
-          printf("%s = ", v.first.c_str());
-          printValue(v.second);
-          printf("\n");
-        }
-        // print stack values
-        for(Value *slot = stack; slot < stackTop; slot++) {
-          printf("stack[%ld] = ", slot - stack);
-          printValue(*slot);
-          printf("\n");
-        }
-        break;
-      }
-      case OpCode::NEWLINE: {
-        printf("\n");
-        break;
-      }
-      case OpCode::JUMP_IF_FALSE: {
-        uint16_t offset = (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]));
-        if (isFalsey(peek(0))) ip += offset;
-        break;
-      }
-      case OpCode::JUMP: {
-        uint16_t offset = (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]));
-        ip += offset;
-        break;
-      }
-      case OpCode::LOOP: {
-        uint16_t offset = (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]));
-        ip -= offset;
-        break;
-      }
-      }
+      Compiler compiler(this, source, end_line);
+      initCompiler(&compiler);
+      compiler.set_current(current);
+      compiler.inputs = inputs_;
+      compiler.longJumps = std::move(longJumps);
+      if (!compiler.compile(chunk_)) return false;
+      if (!compiler.jumpsWidened) break;
+      longJumps = std::move(compiler.longJumps);
+      chunk_->clear();
+    }
+    if (optimize) {
+      PeepholeOptimizer<Real> optimizer;
+      optimizer.optimize(*chunk_);
     }
+    return true;
   }
 
   InterpretResult interpret(const char *source, char end_line = ';') {
-
-    // Think about shared_ptr?
-    Chunk chunk_;
-    Compiler compiler(this, source, end_line);
-    initCompiler(&compiler);
-    compiler.set_current(current);
-
-    // compiler.init(source);
-    if (!compiler.compile(&chunk_)) {
-      return InterpretResult::COMPILE_ERROR;
-    }
-
-    chunk = &chunk_;
-    ip = chunk_.code.data();
-
     VTable locals;
-
-    return run(locals);
+    return interpret(source, end_line, locals);
   }
   InterpretResult interpret(const char *source, char end_line, VTable &locals) {
-
-    // Think about shared_ptr?
-    Chunk chunk_;
-    Compiler compiler(this, source, end_line);
-    initCompiler(&compiler);
-    compiler.set_current(current);
-
-    // compiler.init(source);
-    if (!compiler.compile(&chunk_)) {
+    if (cache.enabled()) {
+      auto program = cache.find(source, end_line, backend, optimize);
+      if (!program) {
+        program = compile(source, end_line);
+        if (!program) return InterpretResult::COMPILE_ERROR;
+        cache.insert(source, end_line, backend, optimize, program);
+      }
+      return run(*program, locals);
+    }
+    scratch.chunk.clear();
+    scratch.end_line = end_line;
+    if (!compile(source, end_line, &scratch.chunk) || !selectBackend(scratch, backend)) {
       return InterpretResult::COMPILE_ERROR;
     }
+    return run(scratch, locals);
+  }
 
-    chunk = &chunk_;
-    ip = chunk_.code.data();
-
-    return run(locals);
+  // Keep up to `capacity` compiled programs keyed by source text, end_line, backend
+  // and optimizer setting so repeated interpret() calls skip compilation. Zero
+  // disables the cache.
+  void setCacheCapacity(size_t capacity) { cache.setCapacity(capacity); }
+  void setBackend(Backend backend_) { backend = backend_; }
+  void setOptimize(bool enable) { optimize = enable; }
+  CacheStats cacheStats() const { return cache.stats; }
+  ArenaStats arenaStats() {
+    std::lock_guard<std::mutex> lock(compileMutex);
+    return arena.stats;
   }
   void repl(char end_line = ';') {
     // Compiler compiler(this);
@@ -606,10 +277,17 @@ struct VM {
       // interpret(line);
     }
   }
+  // Run a script, or a program saved with save().
   void runFile(std::string path) {
-    char *source = Utils::readFile(path);
-    auto result = interpret(source);
-    std::free(source);
+    InterpretResult result;
+    if (bytecode::isBytecodeFile(path)) {
+      auto program = load(path);
+      result = program ? run(*program) : InterpretResult::COMPILE_ERROR;
+    } else {
+      char *source = Utils::readFile(path);
+      result = interpret(source);
+      delete[] source;
+    }
     if (result == InterpretResult::COMPILE_ERROR) exit(65);
     if (result == InterpretResult::RUNTIME_ERROR) exit(70);
   }
@@ -1,5 +1,84 @@
+#include <pips/codegen.hpp>
 #include <pips/vm.hpp>
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+#include <set>
+
+static bool isCppKeyword(const std::string &name) {
+  static const char *const keywords[] = {
+      "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool",
+      "break", "case", "catch", "char", "char16_t", "char32_t", "char8_t", "class",
+      "co_await", "co_return", "co_yield", "compl", "concept", "const", "const_cast",
+      "consteval", "constexpr", "constinit", "continue", "decltype", "default", "delete",
+      "do", "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern",
+      "false", "float", "for", "friend", "goto", "if", "inline", "int", "long", "mutable",
+      "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+      "or_eq", "private", "protected", "public", "register", "reinterpret_cast",
+      "requires", "return", "short", "signed", "sizeof", "static", "static_assert",
+      "static_cast", "struct", "switch", "template", "this", "thread_local", "throw",
+      "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using",
+      "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq"};
+  return std::find(std::begin(keywords), std::end(keywords), name) != std::end(keywords);
+}
+
+// C++ identifier for the function generated from a script: the file name without
+// directories and extension. Keywords get a trailing '_', and a name already in
+// `used` (scripts with the same name in different directories) a numeric suffix.
+static std::string functionName(const std::string &path, std::set<std::string> &used) {
+  std::string name = path.substr(path.find_last_of('/') + 1);
+  name = name.substr(0, name.find('.'));
+  for (char &c : name) {
+    if (!std::isalnum(static_cast<unsigned char>(c))) c = '_';
+  }
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) name = "_" + name;
+  if (isCppKeyword(name)) name += "_";
+  std::string unique = name;
+  for (int k = 2; used.count(unique) != 0; k++) unique = name + "_" + std::to_string(k);
+  used.insert(unique);
+  return unique;
+}
+
+// Print one C++ function per script (see pips::CppGenerator).
+static int emitCpp(pips::VM<> &vm,
+                   const std::vector<std::pair<std::string, std::vector<std::string>>> &scripts) {
+  std::string output = pips::CppGenerator<>::prelude();
+  std::set<std::string> names;
+  for (const auto &[path, inputs] : scripts) {
+    char *source = pips::Utils::readFile(path);
+    auto program = vm.compile(source, ';', inputs);
+    delete[] source;
+    if (!program) return 65;
+    pips::CppGenerator<> generator;
+    const std::string function = generator.generate(*program, functionName(path, names));
+    if (function.empty()) {
+      std::fprintf(stderr, "%s: only numeric scripts can be translated to C++.\n", path.c_str());
+      return 65;
+    }
+    output += "\n" + function;
+  }
+  std::fputs(output.c_str(), stdout);
+  return 0;
+}
+
+// Compile scripts and save them as bytecode files that -i runs without compiling.
+static int saveBytecode(pips::VM<> &vm,
+                        const std::vector<std::pair<std::string, std::string>> &scripts) {
+  for (const auto &[path, output] : scripts) {
+    char *source = pips::Utils::readFile(path);
+    auto program = vm.compile(source, ';');
+    delete[] source;
+    if (!program) return 65;
+    if (!vm.save(*program, output)) {
+      std::fprintf(stderr, "Could not write file \"%s\".\n", output.c_str());
+      return 74;
+    }
+  }
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   pips::VM vm;
 
@@ -10,11 +89,32 @@ int main(int argc, char *argv[]) {
   }
   std::vector<std::string> files;
   std::vector<bool> isfile;
+  std::vector<std::pair<std::string, std::vector<std::string>>> emits;
+  std::vector<std::pair<std::string, std::string>> saves;
   bool verbose = false;
   bool repl = false;
   int i = 1;
   while (i < argc) {
-     if (*argv[i] == '-' && *(argv[i] + 1) != '\0' && *(argv[i] + 2) == '\0') {
+     if (std::strcmp(argv[i], "--emit-cpp") == 0) {
+        // Translate a script and its inputs to C++ instead of running it
+        i++;
+        if (i >= argc) {
+            printf("Usage: pips --emit-cpp [script] [input ...]\n");
+            return -1;
+        }
+        emits.push_back({argv[i], {}});
+        while (i + 1 < argc && *argv[i + 1] != '-') {
+            emits.back().second.push_back(argv[++i]);
+        }
+     } else if (std::strcmp(argv[i], "--compile") == 0) {
+        // Save a script as bytecode instead of running it
+        if (i + 2 >= argc) {
+            printf("Usage: pips --compile [script] [output]\n");
+            return -1;
+        }
+        saves.push_back({argv[i + 1], argv[i + 2]});
+        i += 2;
+     } else if (*argv[i] == '-' && *(argv[i] + 1) != '\0' && *(argv[i] + 2) == '\0') {
         char opt = *(argv[i] + 1);
         switch (opt) {
           case 'i': {
@@ -36,6 +136,18 @@ int main(int argc, char *argv[]) {
             repl = true;
             break;
           }
+          case 'b': {
+            vm.setBackend(pips::Backend::REGISTER);
+            break;
+          }
+          case 'j': {
+            vm.setBackend(pips::Backend::NATIVE);
+            break;
+          }
+          case 'O': {
+            vm.setOptimize(true);
+            break;
+          }
           case 'c': {
               // consume arguments until another -? is hit
               std::string lines;
@@ -65,10 +177,17 @@ int main(int argc, char *argv[]) {
             printf("Usage: repl [options] [script]\n");
             printf("Options:\n");
             printf("                          enter the REPL\n");
-            printf("  -i  [script]            run script then enter REPL\n");
+            printf("  -i  [script]            run script (or bytecode) then enter REPL\n");
             printf("  -c  'line1' 'line2' ... run code snippet\n");
             printf("  -v                      verbose output\n");
             printf("  -r                      run in REPL mode after executing files\n");
+            printf("  -b                      run on the register-based VM\n");
+            printf("  -j                      run numeric code as native code (JIT builds)\n");
+            printf("  -O                      run the peephole optimizer on compiled code\n");
+            printf("  --compile [script] [output]\n");
+            printf("                          save a script as bytecode, which -i runs\n");
+            printf("  --emit-cpp [script] [input ...]\n");
+            printf("                          print a C++ function computing a numeric script\n");
             printf("  -h                      display this help message\n");
             return 0;
           }
@@ -77,6 +196,9 @@ int main(int argc, char *argv[]) {
      i++;
   }
 
+  if (!emits.empty()) return emitCpp(vm, emits);
+  if (!saves.empty()) return saveBytecode(vm, saves);
+
   if (verbose) {
     printf("Running:\n");
     for(size_t idx = 0; idx < files.size(); ++idx) {
@@ -85,7 +207,7 @@ int main(int argc, char *argv[]) {
       if (fileFlag) {
           char *source = pips::Utils::readFile(file);
           printf("\n%s\n", source);
-          std::free(source);
+          delete[] source;
       } else {
           printf("\n%s\n", file.c_str());
       }
@@ -109,5 +231,8 @@ int main(int argc, char *argv[]) {
     }
     vm.repl('\n');
   }
+#ifdef PIPS_OPCODE_PROFILE
+  vm.opcodeProfile.report();
+#endif
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+// Every backend must compute what the stack VM computes: the register VM, the
+// peephole optimizer and (in JIT builds) native code run the same scripts, and what
+// they print, return and leave in globals is compared with the stack VM's.
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "pips/jit.hpp"
+#include "pips/vm.hpp"
+
+using namespace pips;
+
+static int failures = 0;
+
+static void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+    failures++;
+  }
+}
+
+struct Case {
+  const char *name;
+  // Run once on the VM before the script is compiled.
+  std::string prelude;
+  std::string source;
+  // Values of the inputs x and y for each run.
+  std::vector<std::pair<double, double>> runs;
+  // Globals printed after every run.
+  std::vector<const char *> globals;
+  // Whether the JIT must compile the script.
+  bool numeric;
+};
+
+struct Config {
+  const char *name;
+  Backend backend;
+  bool optimize;
+};
+
+// What `run` writes to stdout.
+template <typename F>
+static std::string captureStdout(F run) {
+  std::fflush(stdout);
+  std::FILE *file = std::tmpfile();
+  const int saved = dup(fileno(stdout));
+  dup2(fileno(file), fileno(stdout));
+  run();
+  std::fflush(stdout);
+  dup2(saved, fileno(stdout));
+  close(saved);
+  std::string text;
+  std::rewind(file);
+  for (int c = std::fgetc(file); c != EOF; c = std::fgetc(file)) text += static_cast<char>(c);
+  std::fclose(file);
+  return text;
+}
+
+// Everything observable from running `test` on `config`, as text.
+static std::string transcript(const Case &test, const Config &config) {
+  VM<double> vm;
+  vm.setOptimize(config.optimize);
+  if (!test.prelude.empty()) vm.interpret(test.prelude.c_str());
+  auto program = vm.compile(test.source.c_str(), ';', {"x", "y"}, config.backend);
+  if (program == nullptr) return "compile error\n";
+#if PIPS_JIT_AVAILABLE
+  if (config.backend == Backend::NATIVE && test.numeric) {
+    check(program->native != nullptr, std::string(test.name) + " is compiled by the JIT");
+  }
+#endif
+  return captureStdout([&] {
+    for (const auto &[x, y] : test.runs) {
+      const double inputs[2] = {x, y};
+      const InterpretResult status = vm.run(*program, inputs);
+      std::printf("status %d result ", static_cast<int>(status));
+      printValue(vm.returnValue);
+      for (const char *name : test.globals) {
+        std::printf(" %s=", name);
+        if (const auto *value = vm.getGlobal(name)) {
+          printValue(*value);
+        } else {
+          std::printf("undefined");
+        }
+      }
+      std::printf("\n");
+    }
+  });
+}
+
+static std::string repeat(int count, const std::string &step) {
+  std::string text;
+  for (int i = 0; i < count; i++) text += step;
+  return text;
+}
+
+static std::vector<Case> corpus() {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  std::vector<Case> cases = {
+      {"loop", "",
+       "var s = 0; for (var i = 0; i < 10; i = i + 1) { s = s + i * x; } s;",
+       {{1.5, 0}, {-2, 0}}, {"s"}, true},
+      {"nested loops", "",
+       "var t = 0; { var i = 0; while (i < 5) { var j = i; while (j < 5) { t = t + j;"
+       " j = j + 1; } i = i + 1; } } t * y;",
+       {{0, 2}, {0, -0.5}}, {"t"}, true},
+      // Conditions that jump to jumps, which the optimizer threads.
+      {"jump threading", "",
+       "var c = 0; { var i = 0; while (i < 12 and !(i > 9)) { if (i < 3 or i > 6) {"
+       " if (x > 0) c = c + 1; else c = c - 1; } i = i + 1; } } c;",
+       {{1, 0}, {-1, 0}}, {"c"}, true},
+      {"NaN comparisons", "",
+       "var r = 0; if (x < y) r = r + 1; if (!(x < y)) r = r + 2; if (x >= y) r = r + 4;"
+       " if (!(x >= y)) r = r + 8; if (x != x) r = r + 16; if (x == x) r = r + 32;"
+       " if (!(x <= y)) r = r + 64; if (x > y) r = r + 128; r;",
+       {{nan, 1}, {1, nan}, {1, 2}, {2, 1}, {1, 1}}, {"r"}, true},
+      // local + constant, local * local, local = constant and a < b in a condition.
+      {"superinstructions", "var r = 0;",
+       "{ var a = x; var b = 0; var i = 0; while (i < 6) { b = a * a + b; a = a + 1;"
+       " i = 1; i = b; if (a < y) r = r + 1; i = a - x; } r = r + b; } r;",
+       {{1, 4}, {0.5, 3}}, {"r"}, true},
+      {"globals read before defined", "var g = 1;", "g = g + x; g * 2;",
+       {{1, 0}, {2.5, 0}}, {"g"}, true},
+      {"global holding a string", "var g = \"text\";", "var n = x; g == n;", {{1, 0}}, {"g", "n"},
+       true},
+      {"undefined global", "", "h + x;", {{1, 0}}, {"h"}, true},
+      {"strings and print", "",
+       "var a = \"ab\"; var b = a + \"cd\"; print(b); print(x + y); b == \"abcd\";",
+       {{1, 2}}, {"a", "b"}, false},
+      {"math", "", "sin(x) + cos(y) * sqrt(abs(x)) - floor(x / y) + x % 3 + x // y;",
+       {{7.25, 2}, {-3.5, 1.5}}, {}, true},
+  };
+
+  // Wide operands: more than 256 constants and locals, and a jump over more than
+  // 64KB of code.
+  std::string locals = "var w = 0; {";
+  for (int i = 0; i < 300; i++) {
+    locals += " var v" + std::to_string(i) + " = x + " + std::to_string(i) + ";";
+  }
+  locals += " w = v0 + v150 + v299; }";
+  cases.push_back({"wide constants and locals", "", locals + " w;", {{0.5, 0}}, {"w"}, true});
+  cases.push_back({"wide jumps", "var k = 0;",
+                   "if (x > 0) {" + repeat(12000, " k = k + y;") + " } k;",
+                   {{1, 0.25}, {-1, 0.25}}, {"k"}, true});
+  return cases;
+}
+
+int main() {
+  const std::vector<Config> configs = {
+      {"register", Backend::REGISTER, false},
+      {"optimized stack", Backend::STACK, true},
+      {"optimized register", Backend::REGISTER, true},
+      {"native", Backend::NATIVE, false},
+      {"optimized native", Backend::NATIVE, true},
+  };
+  for (const auto &test : corpus()) {
+    const std::string expected = transcript(test, {"stack", Backend::STACK, false});
+    check(expected.find("status 0") != std::string::npos ||
+              std::string(test.name) == "undefined global",
+          std::string(test.name) + " runs on the stack VM");
+    for (const auto &config : configs) {
+      const std::string actual = transcript(test, config);
+      if (actual != expected) {
+        std::fprintf(stderr, "%s on %s:\n  expected: %s  actual:   %s", test.name, config.name,
+                     expected.c_str(), actual.c_str());
+      }
+      check(actual == expected, std::string(test.name) + " on " + config.name);
+    }
+  }
+
+  if (failures == 0) std::printf("backends: all checks passed\n");
+  return failures == 0 ? 0 : 1;
+}
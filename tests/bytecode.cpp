@@ -0,0 +1,82 @@
+// Loading damaged bytecode must fail instead of running it.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "pips/bytecode.hpp"
+#include "pips/vm.hpp"
+
+using namespace pips;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// Deserialize `bytes` after fixing up the checksum of its payload.
+static std::string load(std::vector<uint8_t> bytes, VM<double> &vm) {
+  bytecode::Header header;
+  std::memcpy(&header, bytes.data(), sizeof header);
+  header.checksum = bytecode::crc32(bytes.data() + sizeof header, bytes.size() - sizeof header);
+  std::memcpy(bytes.data(), &header, sizeof header);
+  Program<double> program;
+  return bytecode::deserialize(bytes.data(), bytes.size(), *vm.globalNames, program);
+}
+
+int main() {
+  VM<double> vm;
+  auto program = vm.compile("var x = 1; if (x < 2) { x = x + 300; } x;");
+  check(program != nullptr, "compile");
+  if (program == nullptr) return 1;
+  const auto bytes = bytecode::serialize(*program, *vm.globalNames);
+  check(load(bytes, vm).empty(), "intact file loads");
+
+  // The payload starts with end_line and the code size, then the code.
+  const size_t codeAt = sizeof(bytecode::Header) + 1 + sizeof(uint32_t);
+  const auto &code = program->chunk.code;
+  std::vector<uint8_t> starts(code.size() + 1, 0);
+  size_t jump = code.size();
+  for (size_t i = 0; i < code.size(); i += instructionLength(code[i])) {
+    starts[i] = 1;
+    if (code[i] == OpCode::JUMP_IF_FALSE && jump == code.size()) jump = i;
+  }
+  check(jump < code.size(), "script has a conditional jump");
+  if (jump == code.size()) return 1;
+
+  // Point the jump at every operand byte after it in turn.
+  int tried = 0;
+  for (size_t target = jump + 3; target < code.size(); target++) {
+    if (starts[target]) continue;
+    std::vector<uint8_t> damaged = bytes;
+    const size_t offset = target - (jump + 3);
+    damaged[codeAt + jump + 1] = static_cast<uint8_t>(offset >> 8);
+    damaged[codeAt + jump + 2] = static_cast<uint8_t>(offset & 0xff);
+    check(load(damaged, vm) == "malformed code", "jump into an operand is rejected");
+    tried++;
+  }
+  check(tried > 0, "script has operands after the jump");
+
+  // A local read before anything has been pushed into its slot.
+  auto block = vm.compile("{ var a = 1; var b = 2; print(a + b); }");
+  check(block != nullptr, "compile block");
+  if (block == nullptr) return 1;
+  auto blockBytes = bytecode::serialize(*block, *vm.globalNames);
+  check(load(blockBytes, vm).empty(), "intact block loads");
+  check(block->chunk.code[0] == OpCode::CONSTANT, "block starts with a constant");
+  blockBytes[codeAt] = OpCode::GET_LOCAL;
+  blockBytes[codeAt + 1] = 3;
+  check(load(blockBytes, vm) == "malformed code", "local above the stack is rejected");
+
+  // A byte that is not an opcode makes the depth analysis fail.
+  Chunk<double> chunk;
+  chunk.write(OpCode::NIL, 1);
+  chunk.write(0xff, 1);
+  check(chunk.computeMaxDepth() == -1, "invalid opcode has no depth");
+
+  if (failures == 0) std::printf("bytecode: all checks passed\n");
+  return failures == 0 ? 0 : 1;
+}